@@ -2,6 +2,9 @@
    E-Mail: rkulla@gmail.com 
    License: GPL */
 
+#define _FILE_OFFSET_BITS 64 /* files over 2GB */
+#define _GNU_SOURCE /* posix_openpt() and the rest of the pty calls */
+
 #include <curses.h>
 #include <time.h>
 #include <stdlib.h>
@@ -13,6 +16,19 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include <glob.h>
+#include <sys/ioctl.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdatomic.h>
+#include <termios.h>
+#include <poll.h>
 
 #define BUFMAX 1024
 #define OFF 0
@@ -21,6 +37,35 @@
 #define LOWERCASE 2 
 #define CARRIAGE_RETURN 13
 #define LINEFEED 10
+#define BW_STATUS_INTERVAL 5 /* seconds between status bar updates */
+#define PIPE_CHUNK 65536
+#define PIPE_BUFFER (16UL * 1024 * 1024)
+#define PACK_CACHE 2 /* --pack blocks kept inflated, for lines across two */
+#define WINDOW_SIZE (8UL * 1024 * 1024) /* how much of the file is mapped */
+#define PDF_RANGE 8 /* pages handed to pdftotext at a time */
+#define ARCHIVE_WORKERS 8 /* most archive members decoded at once */
+#define ARCHIVE_CHUNK (1UL << 20) /* text a member holds for the writer */
+#define ARCHIVE_IN 65536 /* bytes read or inflated at a time */
+#define ARCHIVE_TAR 1
+#define ARCHIVE_TGZ 2
+#define ARCHIVE_ZIP 3
+#define MIRROR_MAX 16 /* most ttys -t can be given for */
+#define PANE_MAX 8 /* most files --pane can put side by side */
+#define LATENCY_BUCKETS 14 /* < 1ms, 1-2ms, ... >= 4096ms */
+#define SKIM_PROBE (1024 * 1024) /* read to guess the average line length */
+#define SKIM_WINDOW (64 * 1024) /* mapped around each skim sample */
+#define COLLAPSE_MAX 256 /* most earlier lines --collapse compares with */
+#define CONTROL_CLIENTS 8 /* --control connections served at once */
+#define READAHEAD_CHUNK (256 * 1024) /* read at a time by --readahead */
+#define PAIR_ERROR 1 /* --colorize colour pairs */
+#define PAIR_WARN 2
+#define PAIR_INFO 3
+#define PAIR_DEBUG 4
+#define PAIR_TIME 5
+#define PAIR_HEX 6
+#define RSVP_MAX_WORDS 10 /* most words --words puts up at once */
+#define REPLAY_MAX_GAP 10.0 /* seconds, the default for --max-gap */
+#define ROTATE_AHEAD (2 * WINDOW_SIZE) /* decoded in front of the reader */
 
 struct my_windows {
     WINDOW *scrollwin;
@@ -32,16 +77,167 @@ struct {
     char *display_filename;
     char *tty_name;
     FILE *fp;
-    FILE *which;
-    unsigned long int the_file_size;
+    off_t the_file_size;
     unsigned int piped;
-    float percent;
+    double percent;
     unsigned long int page_num;
     char homedir[BUFMAX];
     char text_file[BUFMAX];
     char text_pipe[BUFMAX];
     char text_tmp[BUFMAX];
-} tfile = { NULL, NULL, NULL, NULL, NULL, 0, 1, 0, 1 };
+    atomic_uint growing; /* text_file is still being written */
+} tfile = { NULL, NULL, NULL, NULL, 0, 1, 0, 1 };
+
+/* PDFs are converted a few pages at a time, in order, so the first
+   pages scroll while the rest are still being extracted */
+struct {
+    pthread_t extractor;
+    FILE *out;
+    off_t written;
+    off_t *page_start;   /* where each page's text begins in text_file */
+    unsigned long int pages;
+    atomic_ulong extracted;
+    unsigned int blank;
+    unsigned int active;
+} tpdf = { 0, NULL, 0, NULL, 0, 0, 0, 0 };
+
+/* one file inside a tar or zip archive */
+struct archive_member {
+    char name[BUFMAX];
+    off_t offset;             /* where its data starts in the archive */
+    unsigned long long csize; /* bytes stored in the archive */
+    unsigned long long usize; /* bytes once inflated, if known */
+    unsigned int method;      /* zip: 0 stored, 8 deflated */
+    char *problem;            /* why it can't be decoded, if it can't */
+    char *text;               /* decoded, waiting for the writer */
+    unsigned long long text_len;
+    size_t head;              /* length of the header line in text */
+    unsigned long long body;  /* bytes decoded so far */
+    unsigned int sniffed;     /* checked for binary yet */
+    unsigned int binary;
+    char last;                /* last byte decoded */
+    off_t start;              /* where its text begins in text_file */
+    unsigned int full;        /* text is full and the writer is to take it */
+    unsigned int done;
+};
+
+/* Archive members are decoded several at a time by a pool of workers
+   and appended to text_file in archive order, ARCHIVE_CHUNK at a time. */
+struct {
+    unsigned int type;
+    int fd;
+    gzFile gz;
+    pthread_t lister;
+    pthread_t writer;
+    pthread_t worker[ARCHIVE_WORKERS];
+    unsigned int workers;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    FILE *out;
+    off_t written_bytes;
+    struct archive_member **member;
+    unsigned long int count;
+    unsigned long int alloced;
+    unsigned long int next;    /* next member a worker picks up */
+    unsigned long int written; /* members appended to text_file */
+    unsigned int listed;       /* every member has been found */
+    unsigned int blank;
+    unsigned int partial;      /* the last write ended mid line */
+    unsigned int active;
+} tarc = { 0, -1, NULL, 0, 0, { 0 }, 0, PTHREAD_MUTEX_INITIALIZER, 
+           PTHREAD_COND_INITIALIZER, NULL, 0, NULL, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+/* one file of a rotated log set */
+struct rot_segment {
+    char *name;
+    unsigned long int number; /* the 3 in app.log.3.gz */
+    time_t mtime;
+    off_t estimate;           /* its size once uncompressed, roughly */
+    off_t start;              /* where its text begins in text_file */
+};
+
+/* A rotated log set scrolled as one stream, oldest first. Segments are
+   decoded into text_file only as the scroll position gets near them. */
+struct {
+    char *pattern;
+    struct rot_segment *seg;
+    unsigned long int segments;
+    atomic_ulong opened;
+    off_t estimate;
+    pthread_t feeder;
+    FILE *out;
+    _Atomic off_t written;
+    _Atomic off_t shown; /* where the display is, published by next_line */
+    unsigned int blank;
+    atomic_uint lazy;
+    unsigned int active;
+} trot = { NULL, NULL, 0, 0, 0, 0, NULL, 0, 0, 0, 0, 0 };
+
+/* Anything else goes through lesspipe and fmt into text_file in the
+   background, so even a huge file starts scrolling straight away */
+struct {
+    pthread_t feeder;
+    FILE *out;
+    unsigned int blank;
+} ttext = { 0, NULL, 0 };
+
+/* Reads a file through a fixed-size mapping that slides forward, so
+   memory use and page cache stay small however big the file is. */
+struct window_reader {
+    int fd;
+    off_t size;
+    off_t base;
+    char *map;
+    size_t len;
+    off_t pos;
+    size_t window;       /* how much to map at a time */
+    unsigned int random; /* skim: sampled here and there, not read through */
+};
+
+struct window_reader twin = { -1, 0, 0, NULL, 0, 0, WINDOW_SIZE, 0 };
+
+/* the text's line count, filled in by a background pass */
+struct {
+    pthread_t counter;
+    atomic_ulong lines;
+    atomic_uint done;
+} tcount = { 0, 0, 0 };
+
+/* --readahead: a thread reads the text ahead of the scroll, so its pages
+   are in memory by the time the scroll gets there. If the scroll gets
+   there first it waits with the keys working and the status bar saying
+   "buffering", instead of hanging in a page fault on a slow filesystem. */
+struct {
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t moved;      /* the scroll has read on */
+    off_t size;                /* how far ahead to keep, 0 when off; only
+                                  set before the thread starts */
+    unsigned int failed;       /* couldn't start, read as if it were off */
+    off_t want;                /* where the scroll has got to */
+    off_t from;                /* [from, ready) has been read */
+    off_t ready;
+    off_t end;                 /* the file's size, last looked at */
+    unsigned long int stalls;
+    unsigned int stalled;
+} tahead = { 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 
+             0, 0, 0, 0, 0, 0 };
+
+/* --resume: where a file was left, saved by quit_cleanly(). The text it
+   was scrolled from is kept too, for the last file quit, so coming back
+   to that one skips lesspipe, fmt and the rest. */
+struct {
+    unsigned int active;       /* --resume */
+    unsigned int speed_given;  /* -s wins over the saved speed */
+    struct scroll_state *st;   /* the scroll to save, once it's going */
+    char path[BUFMAX + 32];    /* the checkpoint, named after the file */
+    char text[BUFMAX + 32];    /* where the kept text goes */
+    struct stat sb;            /* the file as it was opened */
+    off_t offset;
+    unsigned long int line;
+    unsigned long int total;
+    unsigned int speed;
+} tresume = { 0, 0, NULL, { 0 }, { 0 }, { 0 }, 0, 0, 0, 0 };
 
 struct text_options {
     unsigned long int default_speed;
@@ -58,38 +254,435 @@ struct text_options {
     unsigned int statusbar;
     unsigned int auto_pause;
     unsigned int beep_ok;
-    unsigned int reshow_statusbar;
-    unsigned int highlight;
     unsigned int new_speed;
     SCREEN *stdin_screen;
-} topt = { 1000, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0 };
+    unsigned long int bandwidth; /* output cap in bytes per second */
+    unsigned int word_given;
+    unsigned int benchmark;
+    unsigned int ignore_case;
+    char *folded_word; /* special_word in lower case for -i */
+    char *drawn_word;  /* special_word as -u/-l would draw it */
+    unsigned char *case_table;
+    unsigned int colorize;
+} topt = { 1000, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, NULL, 0,
+           0, 0, 0, NULL, NULL, NULL, 0 };
+
+unsigned char upper_table[256], lower_table[256];
+
+/* A FIFO of bytes kept either in memory or in a file, wrapping around
+   at cap. Used for piped input so endless producers stay bounded. */
+struct byte_ring {
+    char *mem;
+    int fd;
+    unsigned long long cap;
+    unsigned long long head;
+    unsigned long long used;
+};
+
+/* piped input: newest data in memory, the oldest spilled to a capped
+   file once memory is full, and dropped once that's full too */
+struct {
+    pthread_t reader;
+    pthread_mutex_t lock;
+    struct byte_ring mem;
+    struct byte_ring spill;
+    unsigned long long bytes_in;
+    unsigned long int received;
+    unsigned long int dropped;
+    unsigned int eof;
+    unsigned int blank;   /* squeezing, as strip_extra_blanks() does */
+    unsigned int midline; /* the last read ended partway through a line */
+    unsigned int skip;    /* and that line is being left out */
+} tpipe = { 0, PTHREAD_MUTEX_INITIALIZER, { NULL, -1, PIPE_BUFFER, 0, 0 },
+            { NULL, -1, PIPE_BUFFER, 0, 0 }, 0, 0, 0, 0, 0, 0, 0 };
+
+/* a PIPE_CHUNK of piped input, deflated */
+struct pack_block {
+    unsigned char *data;
+    unsigned long zlen;
+    unsigned long len;
+    unsigned long lines;
+    unsigned long long seq;
+    unsigned int whole;   /* it ends at the end of a line */
+};
+
+/* --pack: piped input moved out of --buffer is deflated a block at a
+   time and kept in memory instead of the spill file. The blocks are a
+   FIFO like the rings; the ones being read are kept inflated. */
+struct {
+    struct pack_block *block;
+    unsigned long first;      /* the oldest block still queued */
+    unsigned long count;
+    unsigned long alloced;
+    unsigned long long cap;   /* deflated bytes allowed, 0 when off */
+    unsigned long long zused; /* deflated bytes queued */
+    unsigned long long used;  /* what they inflate to, less what's read */
+    unsigned long long off;   /* read so far from the oldest block */
+    unsigned long long seq;   /* the next block's number */
+    struct {
+        char *data;
+        unsigned long long seq;
+        unsigned int valid;
+    } cache[PACK_CACHE];
+    unsigned int cache_next;  /* the slot the next miss goes in */
+} tpack = { NULL, 0, 0, 0, 0, 0, 0, 0, 0, { { NULL, 0, 0 } }, 0 };
+
+/* where every line matching -w starts, filled in by a background pass */
+struct match_pos {
+    unsigned long int line;
+    off_t offset;
+};
+
+struct {
+    pthread_t indexer;
+    pthread_mutex_t lock;
+    struct match_pos *pos;
+    unsigned long int count;
+    unsigned long int alloced;
+    unsigned long int current; /* matches at or before the line shown */
+    long jump;                 /* match to jump to, -1 for none */
+    unsigned int running;
+    unsigned int done;
+    atomic_uint generation;    /* bumped when -w changes under an indexer,
+                                  checked by it for every line */
+} tmatch = { 0, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, -1, 0, 0, 0 };
+
+/* --colorize: where in a line the tokens worth colouring are */
+struct color_span {
+    size_t start;
+    size_t len;
+    attr_t attr;
+};
+
+struct color_spans {
+    struct color_span *span;
+    unsigned int count;
+    unsigned int alloced;
+};
+
+/* what a scroll loop is doing right now */
+struct scroll_state {
+    unsigned int scroll_speed;
+    unsigned int origspeed;
+    unsigned int toggle;
+    unsigned long int total_lines;
+    unsigned long int line;
+    unsigned int matched;
+    attr_t attr;
+    char *out;          /* what gets drawn: the line or rbuf */
+    char rbuf[BUFMAX];  /* case changed copy of the line */
+    char fold[BUFMAX];  /* lower cased copy for -i matching */
+    struct color_spans colors;
+    void (*status)(struct scroll_state *);
+    void (*draw)(char *, struct scroll_state *);
+    void (*wait)(struct scroll_state *);
+    void (*input)(struct scroll_state *); /* keys read while sleeping */
+};
+
+/* Per-line work, assembled once from the options by build_pipeline()
+   so that features which are switched off cost nothing per line. */
+typedef void (*line_stage)(char *, struct scroll_state *);
+
+struct {
+    line_stage stage[8];
+    unsigned int count;
+} tpipeline = { { NULL }, 0 };
+
+/* --replay: lines come out with the gaps between their timestamps */
+struct {
+    double mult;      /* 2 plays twice as fast as it happened */
+    double max_gap;   /* seconds; longer quiet spells are cut to this */
+    double speed;     /* mult with 'f'/'s' taken into account */
+    double last;      /* the previous timestamp */
+    double due;       /* when the line goes on screen, monotonic clock */
+    unsigned int have_last;
+    unsigned int active;
+} trep = { 1.0, REPLAY_MAX_GAP, 1.0, 0, 0, 0, 0 };
+
+/* Every -t after the one input comes from (or every -t, for a file)
+   shows the same scroll on its own SCREEN, copied from the main one */
+struct {
+    char *tty_name[MIRROR_MAX];
+    unsigned int ttys;
+    SCREEN *screen[MIRROR_MAX];
+    WINDOW *scrollwin[MIRROR_MAX];
+    WINDOW *statwin[MIRROR_MAX];
+    unsigned int count;
+} tmirror = { { NULL }, 0, { NULL }, { NULL }, { NULL }, 0 };
+
+/* --pane: files scrolled side by side, each at its own speed and with
+   its own word, all moved on by one loop in pane_scroll() */
+struct pane {
+    char *filename;
+    char text_file[BUFMAX + 32];
+    struct window_reader wr;
+    WINDOW *win;
+    WINDOW *statwin;
+    unsigned long int speed; /* 0 for -s */
+    char *word;              /* lower cased with -i */
+    double due;
+    unsigned long int line;
+    unsigned long int total;
+    unsigned int done;
+};
+
+struct {
+    struct pane pane[PANE_MAX];
+    unsigned int count;
+} tpanes = { { { NULL } }, 0 };
+
+/* --rsvp: the text a word at a time, from an index of where each
+   word starts and how long it is, built ahead of the display */
+struct {
+    pthread_t indexer;
+    pthread_mutex_t lock;
+    off_t *offset;
+    unsigned char *len;       /* capped at 255 */
+    unsigned long int count;
+    unsigned long int alloced;
+    unsigned long int current; /* words shown so far */
+    unsigned int wpm;
+    unsigned int words;        /* words per frame */
+    double speed;              /* wpm with 'f'/'s' taken into account */
+    unsigned int done;
+    unsigned int active;
+} trsvp = { 0, PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 0, 0, 0, 1, 0, 0, 0 };
+
+/* --export: the decoders write into a pipe instead of text_file, and
+   export_reader() copies it to stdout */
+struct {
+    unsigned int active;
+    int fd[2];
+    pthread_t reader;
+} texport = { 0, { -1, -1 }, 0 };
+
+/* --nowrap: lines are kept whole and shown from column col on. The
+   lines on screen are kept, by row, so panning can redraw them. */
+struct {
+    unsigned int active;
+    unsigned long int col;
+    char **line;
+    size_t *len;
+    size_t *alloced;
+    attr_t *attr;
+    struct color_spans *colors;
+    char *fold;        /* lower cased line for -i */
+    size_t fold_alloced;
+    unsigned int rows;
+    unsigned int top;  /* the slot row 0 is in */
+} thscroll = { 0, 0, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0 };
+
+/* --latency: scripted keys on a clock that skips the scroll's sleeps,
+   recording how long each key took to show once it was read, and how
+   late each frame was */
+struct {
+    unsigned int active;
+    FILE *script;
+    FILE *report;
+    double start;
+    double skipped;   /* sleeps skipped so far, added to the clock */
+    double key_at;    /* when the next scripted key is pressed */
+    int key;          /* ERR once the script has run out */
+    double pressed;   /* when a key now being acted on was read, real
+                         time without the sleeps skipped, or 0 */
+    double due;       /* when the next frame should go out, or 0 */
+    double *took;
+    unsigned long int count;
+    unsigned long int alloced;
+    double key_max;
+    double frame_max;
+    unsigned long int frame_count;
+    unsigned long int keys[LATENCY_BUCKETS];
+    unsigned long int frames[LATENCY_BUCKETS];
+    double max;       /* --latency-max, in ms */
+} tlat = { 0, NULL, NULL, 0, 0, 0, ERR, 0, 0, NULL, 0, 0, 0, 0, 0, { 0 }, 
+           { 0 }, 0 };
+
+/* --skim-lines/--skim-bytes: one line every stride bytes, found by
+   seeking, so only the samples are read */
+struct {
+    unsigned long int lines;
+    off_t stride;
+    double line_len;  /* average, from the start of the file */
+    unsigned long int samples;
+    off_t at;         /* where the line being shown starts */
+    unsigned int active;
+} tskim = { 0, 0, 0, 0, 0, 0 };
+
+/* --collapse: a line that's the same as one of the last few is counted
+   instead of shown. Only a hash of each of those lines is kept. */
+struct {
+    unsigned int window;  /* how many earlier lines to compare with */
+    unsigned int mask;    /* --mask: which digits they are doesn't count */
+    unsigned long long hash[COLLAPSE_MAX];
+    unsigned int at;      /* the slot the next line's hash goes in */
+    unsigned int filled;
+    unsigned int partial; /* the last line was longer than BUFMAX */
+    unsigned long int repeats; /* in the run being collapsed */
+    unsigned long int suppressed;
+    unsigned long int shown;
+    char held[BUFMAX];    /* the line that ended a run, due after the note */
+    unsigned int holding;
+    unsigned int active;
+} tcollapse = { 1, 0, { 0 }, 0, 0, 0, 0, 0, 0, { 0 }, 0, 0 };
+
+/* Bytes sent to the terminal, for --bandwidth and the 'i' screen. curses
+   writes to a pty of ours, and output_relay() passes it on and counts it. */
+struct {
+    int master;                /* what curses writes comes out here */
+    int slave;                 /* curses writes here */
+    int tty;                   /* the real terminal */
+    int tty_in;                /* its keys, which curses reads itself */
+    pthread_t relay;
+    pthread_mutex_t lock;      /* held while relaying, so counts are whole */
+    struct termios saved;      /* tty_in and tty as they were */
+    struct termios saved_out;
+    unsigned int restore;
+    unsigned long long relayed;
+    unsigned long long wchar;  /* relayed as of the last count */
+    unsigned long long pending;
+    unsigned long long last_line;
+    unsigned long long total;
+    unsigned long int lines;
+    long credit;
+    struct timespec stamp;
+    time_t last_status;
+} tout = { -1, -1, -1, -1, 0, PTHREAD_MUTEX_INITIALIZER, { 0 }, { 0 }, 0, 0, 
+           0, 0, 0, 0, 0, 0, { 0, 0 }, 0 };
+
+/* --control: commands read from a Unix socket whenever the keys are, so
+   a running scroll can be driven without restarting it */
+struct {
+    char *path;
+    int fd;                    /* listening, -1 when off */
+    struct {
+        int fd;                /* -1 for a free slot */
+        char buf[BUFMAX];      /* a command still coming in */
+        size_t len;
+    } client[CONTROL_CLIENTS];
+    struct scroll_state *st;   /* what the commands act on */
+    char **argv;               /* to start over with another file */
+    int argc;
+    char *word;                /* the last "pattern", freed when replaced */
+    unsigned int wake;         /* "resume" while paused */
+    unsigned int waiting;      /* in wait_key(), already paused */
+} tctl = { NULL, -1, { { -1, { 0 }, 0 } }, NULL, NULL, 0, NULL, 0, 0 };
   
 
 void scan_command_line(int, char **);
 void text_colors(void);
 void scroll_it(unsigned int, int, char *, char *);
+void line_scroll(struct scroll_state *);
 void usage(char *);
 void quit_cleanly(void);
+void resume_setup(void);
+unsigned int resume_how(void);
+int resume_load(void);
+void resume_save(void);
+void resume_forget(void);
 void get_stats(unsigned long int, unsigned long int);
-void highlight_word(char *, unsigned int, unsigned int, unsigned int, 
-                    unsigned long int, unsigned long int);
-void user_input(unsigned int *, unsigned int, unsigned int *, unsigned long int, 
-                unsigned long int);
+void highlight_word(struct scroll_state *);
+void user_input(struct scroll_state *);
+void user_action(struct scroll_state *, unsigned int);
 void do_options(unsigned int, int, char *, char *);
 unsigned int get_key(void);
 int char_check(char *);
-long get_total_lines(FILE *);
-void change_case(char *, int);
-void char_scroll(unsigned int);
+void *count_lines(void *);
+void start_line_count(void);
+void *readahead_reader(void *);
+void start_readahead(void);
+void readahead_wait(struct scroll_state *);
+int readahead_fill(void);
+unsigned long int count_pieces(off_t);
+int wr_open(struct window_reader *, char *);
+void wr_sample(struct window_reader *);
+void wr_close(struct window_reader *);
+int wr_map(struct window_reader *, off_t);
+int wr_grow(struct window_reader *);
+char *wr_gets(struct window_reader *, char *, int);
+void wr_seek(struct window_reader *, off_t);
+char *wr_gets_whole(struct window_reader *, char *, int);
+int wr_wait(struct window_reader *);
+int pdf_stream(void);
+int pdf_range(unsigned long int, unsigned long int);
+void *pdf_extractor(void *);
+unsigned long int pdf_page_at(off_t);
+int check_if_archive(char *);
+int archive_stream(void);
+int archive_read(char *, unsigned long long, off_t);
+void archive_add(struct archive_member *);
+void list_tar(void);
+void list_zip(void);
+void zip_broken(char *);
+int zip64_extra(unsigned char *, unsigned int, unsigned long long *,
+                unsigned long long *, unsigned long long *);
+void *archive_lister(void *);
+void *archive_worker(void *);
+void *archive_writer(void *);
+unsigned long long archive_decode(struct archive_member *);
+int archive_push(struct archive_member *, z_stream *, int, char *, 
+                 unsigned long long);
+void archive_emit(struct archive_member *, char *, unsigned long long);
+void archive_sniff(struct archive_member *);
+void archive_hand(struct archive_member *);
+void archive_end(struct archive_member *);
+off_t archive_write(struct archive_member *, unsigned int);
+unsigned long int archive_member_at(off_t);
+int squeeze_blank(char *, unsigned int *);
+int rotated_stream(void);
+int text_stream(void);
+void *text_feeder(void *);
+unsigned long long text_copy(FILE *);
+int rotated_order(const void *, const void *);
+void *rotated_feeder(void *);
+unsigned long int rotated_segment_at(off_t);
+void init_case_tables(void);
+void fold_word(void);
+unsigned long int fold_case(char *, char *, unsigned char *);
+void char_scroll(struct scroll_state *);
+void build_pipeline(struct scroll_state *);
+void run_pipeline(char *, struct scroll_state *);
+void stage_match_cursor(char *, struct scroll_state *);
+void stage_highlight(char *, struct scroll_state *);
+void stage_case(char *, struct scroll_state *);
+void stage_highlight_nocase(char *, struct scroll_state *);
+void stage_highlight_folded(char *, struct scroll_state *);
+void status_every(struct scroll_state *);
+void status_throttled(struct scroll_state *);
+void status_none(struct scroll_state *);
+void draw_line(char *, struct scroll_state *);
+void draw_line_bottom(char *, struct scroll_state *);
+void stage_replay(char *, struct scroll_state *);
+void wait_replay(struct scroll_state *);
+void wait_fixed(struct scroll_state *);
+double mono_now(void);
+int sleep_until(double, struct scroll_state *);
+void *rsvp_indexer(void *);
+void start_rsvp_index(void);
+double rsvp_duration(char *, unsigned int);
+double rsvp_frame(char *, int, struct scroll_state *);
+void rsvp_scroll(struct scroll_state *);
+char *wr_peek(struct window_reader *, off_t, size_t);
+long read_digits(char *, unsigned int);
+double read_fraction(char *);
+long days_from_civil(long, long, long);
+int parse_stamp(char *, double *);
+void benchmark(void);
+double benchmark_run(char **, unsigned long int, unsigned long int,
+                     void (*)(char *, struct scroll_state *), 
+                     struct scroll_state *);
+void benchmark_before(char *, struct scroll_state *);
+void benchmark_flush(char *, struct scroll_state *);
 void show_info(unsigned int, unsigned int, unsigned long int, unsigned long int);
-int file_size(FILE *);
+off_t file_size(FILE *);
 int check_if_pdf(char *);
-void lesspipe(void);
-void fmt(void);
+void lesspipe(char *, char *);
+void fmt(char *, char *, int);
 void get_editor(void);
 int start_editor(unsigned long int);
-void strip_extra_blanks(void);
+void strip_extra_blanks(char *, char *);
 char *get_basename(char *);
+char *shell_quote(char *, size_t, char *);
 char *str_trunc(char *, int);
 void my_perror(char *);
 void cperror(char *);
@@ -97,27 +690,127 @@ void catch_sigwinch(int signo);
 void catch_sigint(int signo);
 void signal_setup(void);
 void create_windows(void);
+void setup_screen(void);
+void mirror_setup(void);
+void mirror_copy(WINDOW *, WINDOW *);
+void mirror_frame(void);
+void mirror_end(void);
 void check_homedir(void);
 void check_stdin(void);
 FILE *open_tty(char *);
+void output_setup(void);
+SCREEN *output_screen(FILE *, FILE *);
+void *output_relay(void *);
+void output_pump(void);
+void output_resize(void);
+void output_end(void);
+unsigned long long output_written(void);
+void output_baseline(void);
+void output_account(unsigned int);
+int status_due(void);
+unsigned long long parse_size(char *);
+void ring_io(struct byte_ring *, unsigned long long, char *, unsigned long long,
+             int);
+void ring_put(struct byte_ring *, char *, unsigned long long);
+unsigned long long ring_drop_lines(struct byte_ring *, unsigned long long);
+unsigned long long pipe_peek(char *, unsigned long long);
+void pipe_store(char *, unsigned long long);
+void *pipe_reader(void *);
+unsigned long long pipe_squeeze(char *, unsigned long long);
+void pipe_fmt(void);
+void pack_put(char *, unsigned long);
+char *pack_inflate(struct pack_block *);
+void pack_drop(void);
+unsigned long long pack_peek(char *, unsigned long long);
+void pack_consume(unsigned long long);
+int pipe_gets(char *, int, int);
+char *next_line(char *, int, struct scroll_state *);
+int word_match(char *, char *, char *);
+void *match_indexer(void *);
+void start_match_index(void);
+void match_advance(unsigned long int);
+void match_request(int);
+int match_jump(unsigned long int *);
+void pane_add(char *);
+void pane_setup(unsigned int);
+void pane_status(struct pane *);
+void pane_step(struct pane *, struct scroll_state *);
+void pane_scroll(unsigned int);
+void pane_input(struct scroll_state *);
+void pane_cleanup(void);
+void export_text(void);
+void *export_reader(void *);
+unsigned long long export_copy(FILE *, unsigned int);
+FILE *text_output(void);
+void hscroll_setup(void);
+void stage_nowrap(char *, struct scroll_state *);
+void draw_line_nowrap(char *, struct scroll_state *);
+void hscroll_row(unsigned int);
+void hscroll_scrolled(void);
+void hscroll_pan(long);
+void latency_pty(void);
+void latency_next(void);
+int latency_key(void);
+int latency_wait(void);
+void latency_count(unsigned long int *, double);
+void latency_seen(void);
+void latency_frame(void);
+int latency_order(const void *, const void *);
+int latency_report(void);
+void nap(unsigned int);
+int wait_key(WINDOW *);
+void skim_setup(void);
+void colorize_setup(void);
+void color_add(struct color_spans *, size_t, size_t, attr_t);
+attr_t color_level(unsigned char *, size_t);
+size_t color_stamp(unsigned char *, unsigned char *);
+void colorize_line(char *, size_t, struct color_spans *);
+void stage_colorize(char *, struct scroll_state *);
+void draw_line_color(char *, struct scroll_state *);
+unsigned long long collapse_hash(char *);
+int collapse_seen(char *);
+void collapse_note(char *, size_t, unsigned int);
+char *next_shown(char *, int, struct scroll_state *);
+void stage_skim(char *, struct scroll_state *);
+void control_setup(void);
+void control_poll(void);
+void control_command(int, char *);
+void control_reply(int, char *);
+void control_status(int);
+int control_jump(struct scroll_state *, unsigned long int);
+void control_pattern(struct scroll_state *, char *);
+void control_load(int, char *);
 
 int main(int argc, char **argv)
 {
+    /* kept before getopt_long() reorders them, for --control's "load" */
+    if (!(tctl.argv = (char **)calloc(argc + 1, sizeof(char *)))) {
+        my_perror("calloc()");
+    }
+
+    memcpy(tctl.argv, argv, argc * sizeof(char *));
+    tctl.argc = argc;
     signal_setup();
     check_homedir();
     get_editor();
     scan_command_line(argc, argv);
     unlink(tfile.text_file);
+    pane_cleanup();
+
+    if (tctl.path) {
+        unlink(tctl.path);
+    }
 
     if (tfile.piped) {
         unlink(tfile.text_pipe);
     }
 
+    mirror_end();
     clear();
     refresh();
     endwin();
 
-    return 0;
+    return latency_report();
 }
 
 void check_homedir(void)
@@ -125,7 +818,7 @@ void check_homedir(void)
     char *home = getenv("HOME");
 
     if (home) {
-        snprintf(tfile.homedir, (strlen(home) + 12), "%s/.textscroll/", home);
+        snprintf(tfile.homedir, sizeof tfile.homedir, "%s/.textscroll/", home);
 
         if ((access(tfile.homedir, F_OK|W_OK)) != 0) {
             if (mkdir(tfile.homedir, S_IRUSR|S_IWUSR|S_IXUSR) != 0) {
@@ -148,655 +841,5362 @@ void check_homedir(void)
    when input is piped from another program */
 void check_stdin(void)
 {
-    char stdin_buf[BUFMAX];
-    FILE *fp, *input, *output;
+    FILE *input, *output;
 
     if (tfile.piped) {
+        if (!tfile.tty_name) {
+            usage("textscroll");
+        }
+
         input = output = open_tty(tfile.tty_name); 
 
-        if (!(fp = fopen(tfile.text_pipe, "w"))) {
-            my_perror("fopen()");
+        if (!(tpipe.mem.mem = (char *)malloc(tpipe.mem.cap))) {
+            my_perror("malloc()");
         }
 
-        while (fgets(stdin_buf, sizeof stdin_buf, stdin)) {
-            fprintf(fp, "%s", stdin_buf);
+        pipe_fmt();
+
+        /* stdin is read while we scroll, so endless producers work */
+        if (pthread_create(&tpipe.reader, NULL, pipe_reader, NULL) != 0) {
+            my_perror("pthread_create()");
         }
 
-        fclose(fp);
-        topt.stdin_screen = newterm((char *)0, output, input);
+        if (topt.bandwidth) {
+            topt.stdin_screen = output_screen(output, input);
+        } else {
+            topt.stdin_screen = newterm((char *)0, output, input);
+        }
     }
 }
 
-FILE *open_tty(char *tty_path)
+/* "64M" style sizes for --buffer and --spill */
+unsigned long long parse_size(char *str)
 {
-    FILE *fp;
-    struct stat sb;
-
-    if (stat(tty_path, &sb) < 0) {
-        my_perror(tty_path);
+    char *end;
+    unsigned long long n = strtoull(str, &end, 10);
+
+    switch (toupper(*end)) {
+        case 'G':
+            n *= 1024;
+            /* fall through */
+        case 'M':
+            n *= 1024;
+            /* fall through */
+        case 'K':
+            n *= 1024;
+            end++;
+            break;
     }
 
-    if ((sb.st_mode & S_IFMT) != S_IFCHR) {
-        errno = ENOTTY;
-        my_perror(tty_path);
+    if (end == str || *end != '\0') {
+        return 0;
     }
 
-    if (!(fp = fopen(tty_path, "a+"))) {
-        my_perror("fopen()");
-    }
+    return n;
+}
 
-    if (fp == 0) {
-        my_perror(tty_path);
+/* copy n bytes in (write) or out of the ring at offset off from the head */
+void ring_io(struct byte_ring *r, unsigned long long off, char *data,
+             unsigned long long n, int write)
+{
+    unsigned long long pos = (r->head + off) % r->cap, part;
+
+    while (n) {
+        part = r->cap - pos < n ? r->cap - pos : n;
+
+        if (r->mem && write) {
+            memcpy(r->mem + pos, data, part);
+        } else if (r->mem) {
+            memcpy(data, r->mem + pos, part);
+        } else if (write) {
+            if (pwrite(r->fd, data, part, pos) != (ssize_t)part) {
+                cperror("pwrite()");
+            }
+        } else if (pread(r->fd, data, part, pos) != (ssize_t)part) {
+            cperror("pread()");
+        }
+
+        data += part;
+        n -= part;
+        pos = 0;
     }
+}
 
-    return fp;
+void ring_put(struct byte_ring *r, char *data, unsigned long long n)
+{
+    ring_io(r, r->used, data, n, 1);
+    r->used += n;
 }
 
-void create_windows(void)
+/* Drop whole lines from the head until at least n bytes are free.
+   Returns how many lines went. */
+unsigned long long ring_drop_lines(struct byte_ring *r, unsigned long long n)
 {
-    initscr();
+    char chunk[4096], *nl;
+    unsigned long long lines = 0, want, off = 0, len;
 
-    if (tfile.piped) {
-        set_term(topt.stdin_screen); /* switch to a real tty */
-        refresh();
-        endwin();
+    if (r->cap - r->used >= n) {
+        return 0;
     }
 
-    cbreak();
-    noecho();
-    nonl();
-    intrflush(stdscr, FALSE);
-    keypad(stdscr, TRUE);
-    curs_set(FALSE);
+    want = n - (r->cap - r->used);
 
-    if (topt.want_color) {
-        text_colors();
+    while (off < r->used) {
+        len = r->used - off < sizeof chunk ? r->used - off : sizeof chunk;
+        ring_io(r, off, chunk, len, 0);
+
+        if ((nl = memchr(chunk, '\n', len))) {
+            off += (nl - chunk) + 1;
+            lines++;
+
+            if (off >= want) {
+                break;
+            }
+        } else {
+            off += len;
+        }
     }
 
-    if (!(pscroll = (struct my_windows *)malloc(sizeof(struct my_windows)))) {
-        cperror("malloc()");
+    if (off < want) {
+        off = want; /* one line bigger than the whole ring */
     }
-   
-    pscroll->scrollwin = newwin(LINES, 0, 0, 0);
 
-    if (!(pstat = (struct my_windows *)malloc(sizeof(struct my_windows)))) {
-        cperror("malloc()");
+    if (off > r->used) {
+        off = r->used;
     }
 
-    pstat->statwin = newwin(1, COLS, LINES - 1, 0);
-    refresh();
+    r->head = (r->head + off) % r->cap;
+    r->used -= off;
+
+    return lines;
 }
 
-void scan_command_line(int argc, char **argv)
+/* Append newly read input, making room by moving the oldest bytes from
+   memory to the spill file, and dropping lines when there's no room left.
+   Called with tpipe.lock held. */
+void pipe_store(char *data, unsigned long long n)
 {
-    int optch, opt;
-    static char optstring[] = "s:p:f:w:c:navhbluxmt:";
-    char speed[20], position[3], *filename_nodashf;
-    unsigned int scroll_speed = topt.default_speed; 
-    char *progname = argv[0];
+    char chunk[PIPE_CHUNK];
+    unsigned long long move;
+    char *c;
 
-    if (argc < 2) {
-        usage(argv[0]);
+    for (c = data; (c = memchr(c, '\n', n - (c - data))); c++) {
+        tpipe.received++;
     }
 
-    if (progname) {
-        filename_nodashf = argv[1];
-    }
+    tpipe.bytes_in += n;
 
-    for (opt = 1; opt < argc; opt++) {
-        if (!strncmp(argv[opt], "-", 1)) {
-            break;
-        } else { /* no options just filename */
-            tfile.piped = FALSE;
+    while (tpipe.mem.cap - tpipe.mem.used < n) {
+        if (tpack.cap) { /* whole blocks, so they deflate well */
+            move = tpipe.mem.used < sizeof chunk ? tpipe.mem.used 
+                                                 : sizeof chunk;
+            ring_io(&tpipe.mem, 0, chunk, move, 0);
+            tpipe.mem.head = (tpipe.mem.head + move) % tpipe.mem.cap;
+            tpipe.mem.used -= move;
+            pack_put(chunk, move);
+            continue;
+        }
 
-            if (strlen(argv[opt]) > BUFMAX) {
-                usage(progname);
-            }
+        if (!tpipe.spill.cap) {
+            tpipe.dropped += ring_drop_lines(&tpipe.mem, n);
+            break;
+        }
 
-            if (!(tfile.filename = (char *)malloc(strlen(argv[opt])+1))) {
-                my_perror("malloc()");
+        if (tpipe.spill.fd < 0) {
+            tpipe.spill.fd = open(tfile.text_pipe, O_RDWR|O_CREAT|O_TRUNC,
+                                  S_IRUSR|S_IWUSR);
+            if (tpipe.spill.fd < 0) {
+                cperror(tfile.text_pipe);
             }
+        }
 
-            strncpy(tfile.filename, argv[opt], strlen(argv[opt]));
+        move = n - (tpipe.mem.cap - tpipe.mem.used);
+        move = move > sizeof chunk ? sizeof chunk : move;
 
-            if (!(tfile.fp = fopen(tfile.filename, "r"))) {
-                my_perror("fopen()");
-            }
-        }
-    }
+        tpipe.dropped += ring_drop_lines(&tpipe.spill, move);
 
-    while ((optch = getopt(argc, argv, optstring)) != -1) {
-        switch (optch) {
-            case 's':
-                if (!char_check(optarg)) {
-                    usage(progname);
-                }
-                strncpy(speed, optarg, 20);
-                scroll_speed = (unsigned int)atoi(speed);
-                break;
-            case 'p':
-                if (!char_check(optarg)) {
-                    usage(progname);
-                }
-                strncpy(position, optarg, 3);
-                topt.pos_changed = (unsigned int)atoi(position);
-                break;
-            case 'f':
-                tfile.piped = FALSE;
-                if (strlen(optarg) > BUFMAX) {
-                    usage(progname);
-                }
-                if (!(tfile.filename = (char *)malloc(strlen(optarg)+1))) {
-                    my_perror("malloc()");
-                }
-                strncpy(tfile.filename, optarg, strlen(optarg));
-                if (!(tfile.fp = fopen(tfile.filename, "r"))) {
-                    my_perror("fopen()"); 
-                }
-                break;
-            case 't':
-                if (!(tfile.tty_name = (char *)malloc(strlen(optarg)+1))) {
-                    my_perror("malloc()");
-                }
-                strncpy(tfile.tty_name, optarg, strlen(optarg));
-                break;
-            case 'w':
-                if (strlen(optarg) > BUFMAX) {
-                    usage(progname);
-                }
-                if (!(topt.special_word = (char *)malloc(strlen(optarg)+1))) {
-                    my_perror("malloc()");
-                }
-                strncpy(topt.special_word, optarg, strlen(optarg));
-                break;
-            case 'n':
-                topt.view_normal = TRUE;
-                break;
-            case 'u':
-                topt.case_type = UPPERCASE;
-                topt.case_change = TRUE;
-                break;
-            case 'l':
-                topt.case_type = LOWERCASE;
-                topt.case_change = TRUE; 
-                break; 
-            case 'c':
-                topt.want_color = 1;
-                if (!(topt.use_color = (char *)malloc(strlen(optarg)+1))) {
-                    my_perror("malloc");
-                }
-                strncpy(topt.use_color, optarg, strlen(optarg));
-                break;
-            case 'x':
-                topt.statusbar = FALSE;
-                break;
-            case 'v':
-                endwin();
-                printf("textscroll -Ryan Kulla\n");
-                exit(EXIT_SUCCESS);
-                break;
-            case 'h':
-                usage(progname);
-                break;
-            case 'a':
-                topt.auto_pause = TRUE;
-                break;
-            case 'm':
-                topt.scrollmode_chars = TRUE;
-                break;
-            case 'b':
-                topt.beep_ok = TRUE;
-                break;
-            default:
-                usage(progname);
-                break;
-        }
+        ring_io(&tpipe.mem, 0, chunk, move, 0);
+        tpipe.mem.head = (tpipe.mem.head + move) % tpipe.mem.cap;
+        tpipe.mem.used -= move;
+        ring_put(&tpipe.spill, chunk, move);
     }
 
-    do_options(scroll_speed, argc, filename_nodashf, progname);
+    ring_put(&tpipe.mem, data, n);
 }
 
-void text_colors(void)
+void *pipe_reader(void *arg)
 {
-    if (has_colors() == FALSE) {
-        cperror("Your terminal does not support colors");
+    char chunk[PIPE_CHUNK];
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, chunk, sizeof chunk)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (!topt.view_normal && !(n = pipe_squeeze(chunk, n))) {
+            continue;
+        }
+
+        pthread_mutex_lock(&tpipe.lock);
+        pipe_store(chunk, n);
+        pthread_mutex_unlock(&tpipe.lock);
     }
 
-    start_color();
+    pthread_mutex_lock(&tpipe.lock);
+    tpipe.eof = TRUE;
+    pthread_mutex_unlock(&tpipe.lock);
 
-    if (!strncmp(topt.use_color, "red", 3)) 
-        assume_default_colors(COLOR_RED, COLOR_BLACK);
-    if (!strncmp(topt.use_color, "bgred", 5))
-        assume_default_colors(COLOR_WHITE, COLOR_RED);
-    if (!strncmp(topt.use_color, "bgblue", 6))
-        assume_default_colors(COLOR_WHITE, COLOR_BLUE);
-    if (!strncmp(topt.use_color, "blue", 4))
-        assume_default_colors(COLOR_BLUE, COLOR_BLACK);
-    if (!strncmp(topt.use_color, "green", 5))
-        assume_default_colors(COLOR_GREEN, COLOR_BLACK);
-    if (!strncmp(topt.use_color, "bggreen", 7))
-        assume_default_colors(COLOR_BLUE, COLOR_GREEN);
-    if (!strncmp(topt.use_color, "magenta", 7))
-        assume_default_colors(COLOR_MAGENTA, COLOR_BLACK);
-    if (!strncmp(topt.use_color, "bgmagenta", 9)) 
-        assume_default_colors(COLOR_WHITE, COLOR_MAGENTA);
-    if (!strncmp(topt.use_color, "yellow", 6))
-        assume_default_colors(COLOR_YELLOW, COLOR_BLACK);
-    if (!strncmp(topt.use_color, "bgyellow", 8))
-        assume_default_colors(COLOR_WHITE, COLOR_YELLOW);
-    if (!strncmp(topt.use_color, "bgwhite", 7))
-        assume_default_colors(COLOR_BLACK, COLOR_WHITE);
-    if (!strncmp(topt.use_color, "bgblack", 7))
-        assume_default_colors(COLOR_WHITE, COLOR_BLACK);
+    return NULL;
 }
 
-void do_options(unsigned int scroll_speed, int argc, char *filename_nodashf,
-                char *progname)
+/* Leave out the blank lines strip_extra_blanks() would, as they're
+   read. Returns how much of the n bytes is left. */
+unsigned long long pipe_squeeze(char *data, unsigned long long n)
 {
+    char *in = data, *out = data, *end = data + n, *nl, line[2] = "";
+    unsigned long long len;
 
-    if (tfile.piped) {
-        tfile.filename = tfile.text_pipe;
-        check_stdin();
-    }
+    while (in < end) {
+        if (!(nl = memchr(in, '\n', end - in))) {
+            nl = end - 1;
+        }
 
-    /* Call external dependenies */
-    lesspipe();
-    fmt();
+        len = nl + 1 - in;
+
+        if (!tpipe.midline) { /* squeeze_blank() looks at the first byte */
+            line[0] = *in;
+            tpipe.skip = squeeze_blank(line, &tpipe.blank);
+        }
+
+        if (!tpipe.skip) {
+            memmove(out, in, len);
+            out += len;
+        }
 
-    if (!topt.view_normal) {
-        strip_extra_blanks();
+        tpipe.midline = *nl != '\n';
+        in += len;
+    }
+
+    return out - data;
+}
+
+/* Word wrap piped input as files are: fmt reads our stdin and we read
+   fmt. stdbuf, where there is one, stops it holding lines back. */
+void pipe_fmt(void)
+{
+    FILE *fp;
+
+    if (thscroll.active) {
+        return;
+    }
+
+    if (!(fp = popen("if command -v stdbuf >/dev/null 2>&1; then "
+                     "exec stdbuf -oL fmt -s; else exec fmt -s; fi", "r")) ||
+        dup2(fileno(fp), STDIN_FILENO) < 0) {
+        my_perror("popen()");
+    }
+}
+
+/* Queue a block moved out of memory for --pack, dropping the oldest
+   blocks' lines if it doesn't fit. Called with tpipe.lock held. */
+void pack_put(char *data, unsigned long n)
+{
+    struct pack_block *b;
+    uLongf zlen = compressBound(n);
+    unsigned char *z;
+    char *c;
+
+    if (!(z = (unsigned char *)malloc(zlen))) {
+        cperror("malloc()");
+    }
+
+    /* the fastest level: this runs as the input comes in */
+    if (compress2(z, &zlen, (unsigned char *)data, n, Z_BEST_SPEED) != Z_OK) {
+        cperror("compress2()");
+    }
+
+    while (tpack.count && tpack.zused + zlen > tpack.cap) {
+        pack_drop();
+    }
+
+    if (tpack.first + tpack.count == tpack.alloced) {
+        if (tpack.first) { /* slide the queue back to the start */
+            memmove(tpack.block, tpack.block + tpack.first, 
+                    tpack.count * sizeof(struct pack_block));
+            tpack.first = 0;
+        } else {
+            tpack.alloced = tpack.alloced ? tpack.alloced * 2 : 64;
+
+            if (!(tpack.block = (struct pack_block *)realloc(tpack.block,
+                                tpack.alloced * sizeof(struct pack_block)))) {
+                cperror("realloc()");
+            }
+        }
+    }
+
+    b = &tpack.block[tpack.first + tpack.count++];
+    b->data = (unsigned char *)realloc(z, zlen); /* give back the slack */
+    b->data = b->data ? b->data : z;
+    b->zlen = zlen;
+    b->len = n;
+    b->seq = tpack.seq++;
+    b->whole = data[n - 1] == '\n';
+
+    for (b->lines = 0, c = data; (c = memchr(c, '\n', n - (c - data))); c++) {
+        b->lines++;
+    }
+
+    tpack.zused += zlen;
+    tpack.used += n;
+}
+
+/* a queued block's text, from the cache or inflated into it */
+char *pack_inflate(struct pack_block *b)
+{
+    unsigned int i;
+    uLongf len = b->len;
+
+    for (i = 0; i < PACK_CACHE; i++) {
+        if (tpack.cache[i].valid && tpack.cache[i].seq == b->seq) {
+            return tpack.cache[i].data;
+        }
+    }
+
+    i = tpack.cache_next;
+    tpack.cache_next = (tpack.cache_next + 1) % PACK_CACHE;
+
+    if (!tpack.cache[i].data && 
+        !(tpack.cache[i].data = (char *)malloc(PIPE_CHUNK))) {
+        cperror("malloc()");
+    }
+
+    if (uncompress((unsigned char *)tpack.cache[i].data, &len, b->data, 
+                   b->zlen) != Z_OK || len != b->len) {
+        cperror("uncompress()");
+    }
+
+    tpack.cache[i].seq = b->seq;
+    tpack.cache[i].valid = TRUE;
+
+    return tpack.cache[i].data;
+}
+
+/* Let the oldest block go, counting the lines in it that weren't read,
+   along with the rest of a line it ends part way through */
+void pack_drop(void)
+{
+    struct pack_block *b = &tpack.block[tpack.first];
+    unsigned long long left = b->len - tpack.off;
+    unsigned int whole = b->whole;
+    char *c, *text;
+
+    if (!tpack.off) {
+        tpipe.dropped += b->lines;
+    } else {
+        for (text = c = pack_inflate(b) + tpack.off; 
+             (c = memchr(c, '\n', left - (c - text))); c++) {
+            tpipe.dropped++;
+        }
+    }
+
+    tpack.zused -= b->zlen;
+    tpack.used -= left;
+    tpack.off = 0;
+    free(b->data);
+    tpack.first++;
+    tpack.count--;
+
+    if (!whole && tpack.count) {
+        b = &tpack.block[tpack.first];
+        text = pack_inflate(b);
+
+        if ((c = memchr(text, '\n', b->len))) {
+            pack_consume(c - text + 1);
+            b->lines--;
+            tpipe.dropped++;
+        }
+    }
+}
+
+/* copy up to n packed bytes, the oldest first */
+unsigned long long pack_peek(char *buf, unsigned long long n)
+{
+    unsigned long int i;
+    unsigned long long got = 0, off = tpack.off, part;
+    struct pack_block *b;
+
+    for (i = 0; i < tpack.count && got < n; i++) {
+        b = &tpack.block[tpack.first + i];
+        part = b->len - off < n - got ? b->len - off : n - got;
+        memcpy(buf + got, pack_inflate(b) + off, part);
+        got += part;
+        off = 0;
+    }
+
+    return got;
+}
+
+/* n packed bytes have been read */
+void pack_consume(unsigned long long n)
+{
+    struct pack_block *b;
+
+    tpack.used -= n;
+
+    while (n) {
+        b = &tpack.block[tpack.first];
+
+        if (n < b->len - tpack.off) {
+            tpack.off += n;
+            break;
+        }
+
+        n -= b->len - tpack.off;
+        tpack.zused -= b->zlen;
+        tpack.off = 0;
+        free(b->data);
+        tpack.first++;
+        tpack.count--;
+    }
+}
+
+/* copy up to n queued bytes, spilled or packed ones first. Called with 
+   the lock held. */
+unsigned long long pipe_peek(char *buf, unsigned long long n)
+{
+    unsigned long long from_spill, from_mem;
+
+    if (tpack.cap) { /* the spill file isn't used */
+        from_spill = pack_peek(buf, n);
+    } else {
+        from_spill = tpipe.spill.used < n ? tpipe.spill.used : n;
+    }
+
+    if (from_spill && !tpack.cap) {
+        ring_io(&tpipe.spill, 0, buf, from_spill, 0);
+    }
+
+    from_mem = tpipe.mem.used < n - from_spill ? tpipe.mem.used : n - from_spill;
+    ring_io(&tpipe.mem, 0, buf + from_spill, from_mem, 0);
+
+    return from_spill + from_mem;
+}
+
+/* Like fgets() on piped input, but waits at most wait_ms for a complete line.
+   Returns 1 for a line, 0 at end of input and -1 if nothing arrived yet. */
+int pipe_gets(char *buf, int size, int wait_ms)
+{
+    unsigned long long len, take, left;
+    char *nl;
+    int waited = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&tpipe.lock);
+        len = pipe_peek(buf, size - 1);
+
+        if ((nl = memchr(buf, '\n', len))) {
+            take = (nl - buf) + 1;
+        } else if (len == (unsigned long long)(size - 1) || (tpipe.eof && len)) {
+            take = len;
+        } else if (tpipe.eof) {
+            pthread_mutex_unlock(&tpipe.lock);
+            return 0;
+        } else {
+            take = 0;
+        }
+
+        if (take) {
+            buf[take] = '\0';
+
+            left = take;
+
+            if (tpack.used) {
+                len = left < tpack.used ? left : tpack.used;
+                pack_consume(len);
+                left -= len;
+            }
+
+            if (left && tpipe.spill.used >= left) {
+                tpipe.spill.head = (tpipe.spill.head + left) % tpipe.spill.cap;
+                tpipe.spill.used -= left;
+            } else {
+                left -= tpipe.spill.used;
+                tpipe.spill.used = 0;
+                tpipe.mem.head = (tpipe.mem.head + left) % tpipe.mem.cap;
+                tpipe.mem.used -= left;
+            }
+        }
+
+        tfile.the_file_size = tpipe.bytes_in;
+        pthread_mutex_unlock(&tpipe.lock);
+
+        if (take) {
+            return 1;
+        }
+
+        if (waited >= wait_ms) {
+            return -1;
+        }
+
+        napms(10);
+        waited += 10;
+    }
+}
+
+/* The next line to show, or NULL at the end of the input. While a pipe
+   is waiting on its producer the keys and status bar keep working. */
+char *next_line(char *buf, int size, struct scroll_state *st)
+{
+    int got;
+    unsigned int growing;
+
+    if (!tfile.piped) {
+        for (;;) {
+            growing = tfile.growing;
+            st->total_lines = tcount.lines;
+            trot.shown = twin.pos;
+
+            if (tahead.size) {
+                readahead_wait(st);
+            }
+
+            if (wr_gets_whole(&twin, buf, size)) {
+                return buf;
+            }
+
+            if (!growing) {
+                return NULL;
+            }
+
+            /* caught up with the extraction, keep the keys working */
+            st->status(st);
+            user_input(st);
+            napms(50);
+        }
+    }
+
+    while ((got = pipe_gets(buf, size, 250)) < 0) {
+        st->total_lines = tpipe.received;
+        st->status(st);
+        user_input(st);
+    }
+
+    st->total_lines = tpipe.received;
+
+    return got ? buf : NULL;
+}
+
+FILE *open_tty(char *tty_path)
+{
+    FILE *fp;
+    struct stat sb;
+
+    if (stat(tty_path, &sb) < 0) {
+        my_perror(tty_path);
+    }
+
+    if ((sb.st_mode & S_IFMT) != S_IFCHR) {
+        errno = ENOTTY;
+        my_perror(tty_path);
+    }
+
+    if (!(fp = fopen(tty_path, "a+"))) {
+        my_perror("fopen()");
+    }
+
+    if (fp == 0) {
+        my_perror(tty_path);
+    }
+
+    return fp;
+}
+
+void create_windows(void)
+{
+    if (!tfile.piped && !topt.bandwidth) {
+        initscr();
+    } else if (!tfile.piped && tout.master < 0) { /* counted, for the cap */
+        output_screen(stdout, stdin);
+    }
+
+    if (tfile.piped) {
+        set_term(topt.stdin_screen); /* switch to a real tty */
+        refresh();
+        endwin();
+    }
+
+    setup_screen();
+
+    if (!(pscroll = (struct my_windows *)malloc(sizeof(struct my_windows)))) {
+        cperror("malloc()");
+    }
+   
+    /* keep the status bar out of the scroll region on slow links, so
+       scrolling never has to repaint it */
+    if (topt.bandwidth && topt.statusbar) {
+        pscroll->scrollwin = newwin(LINES - 1, 0, 0, 0);
+    } else {
+        pscroll->scrollwin = newwin(LINES, 0, 0, 0);
+    }
+
+    if (topt.bandwidth) {
+        idlok(pscroll->scrollwin, TRUE); /* use the terminal's own scrolling */
+    }
+
+    if (!(pstat = (struct my_windows *)malloc(sizeof(struct my_windows)))) {
+        cperror("malloc()");
+    }
+
+    pstat->statwin = newwin(1, COLS, LINES - 1, 0);
+    refresh();
+}
+
+void setup_screen(void)
+{
+    cbreak();
+    noecho();
+    nonl();
+    intrflush(stdscr, FALSE);
+    keypad(stdscr, TRUE);
+    curs_set(FALSE);
+
+    if (topt.want_color) {
+        text_colors();
+    }
+
+    if (topt.colorize) {
+        colorize_setup();
+    }
+}
+
+/* A SCREEN for each mirror tty. Keys are only read from the main one. */
+void mirror_setup(void)
+{
+    SCREEN *main_screen;
+    FILE *fp;
+    unsigned int i;
+    int lines = LINES, cols = COLS;
+
+    /* initscr() doesn't hand back its SCREEN, but set_term() does */
+    main_screen = set_term(NULL);
+    set_term(main_screen);
+
+    for (i = tfile.piped ? 1 : 0; i < tmirror.ttys; i++) {
+        fp = open_tty(tmirror.tty_name[i]);
+
+        if (!(tmirror.screen[tmirror.count] = newterm(NULL, fp, fp))) {
+            cperror(tmirror.tty_name[i]);
+        }
+
+        setup_screen();
+        tmirror.scrollwin[tmirror.count] = newwin(LINES, 0, 0, 0);
+        tmirror.statwin[tmirror.count] = newwin(1, COLS, LINES - 1, 0);
+        idlok(tmirror.scrollwin[tmirror.count], TRUE);
+        refresh();
+        tmirror.count++;
+    }
+
+    set_term(main_screen);
+    LINES = lines; /* newterm() set them for the last mirror */
+    COLS = cols;
+}
+
+/* as much of src as fits into dst, attributes and all */
+void mirror_copy(WINDOW *src, WINDOW *dst)
+{
+    int rows = getmaxy(src) < getmaxy(dst) ? getmaxy(src) : getmaxy(dst);
+    int cols = getmaxx(src) < getmaxx(dst) ? getmaxx(src) : getmaxx(dst);
+
+    wbkgdset(dst, getbkgd(src));
+    copywin(src, dst, 0, 0, 0, 0, rows - 1, cols - 1, FALSE);
+}
+
+/* Send the frame just drawn to every mirror. Each one's curses only
+   sends what changed there. What that costs isn't counted against
+   --bandwidth, which is about the main terminal's link. */
+void mirror_frame(void)
+{
+    SCREEN *main_screen;
+    unsigned int i;
+
+    if (!tmirror.count) {
+        return;
+    }
+
+    main_screen = set_term(tmirror.screen[0]);
+
+    for (i = 0; i < tmirror.count; i++) {
+        set_term(tmirror.screen[i]);
+        mirror_copy(pscroll->scrollwin, tmirror.scrollwin[i]);
+        mirror_copy(pstat->statwin, tmirror.statwin[i]);
+        wnoutrefresh(tmirror.scrollwin[i]);
+        wnoutrefresh(tmirror.statwin[i]);
+        doupdate();
+    }
+
+    set_term(main_screen);
+    output_baseline();
+}
+
+void mirror_end(void)
+{
+    SCREEN *main_screen;
+    unsigned int i;
+
+    if (!tmirror.count) {
+        return;
+    }
+
+    main_screen = set_term(tmirror.screen[0]);
+
+    for (i = 0; i < tmirror.count; i++) {
+        set_term(tmirror.screen[i]);
+        clear();
+        refresh();
+        endwin();
+    }
+
+    set_term(main_screen);
+}
+
+void scan_command_line(int argc, char **argv)
+{
+    int optch, opt;
+    static char optstring[] = "s:p:f:w:c:navhbluxmt:i";
+    static struct option longopts[] = {
+        { "bandwidth", required_argument, NULL, 'B' },
+        { "buffer", required_argument, NULL, 'M' },
+        { "spill", required_argument, NULL, 'S' },
+        { "pack", required_argument, NULL, 'U' },
+        { "resume", no_argument, NULL, 'F' },
+        { "control", required_argument, NULL, 'T' },
+        { "readahead", required_argument, NULL, 'V' },
+        { "benchmark", no_argument, NULL, 'K' },
+        { "rotated", required_argument, NULL, 'R' },
+        { "replay", optional_argument, NULL, 'P' },
+        { "rsvp", required_argument, NULL, 'W' },
+        { "words", required_argument, NULL, 'N' },
+        { "max-gap", required_argument, NULL, 'G' },
+        { "pane", required_argument, NULL, 'X' },
+        { "export", no_argument, NULL, 'E' },
+        { "nowrap", no_argument, NULL, 'H' },
+        { "latency", required_argument, NULL, 'L' },
+        { "latency-max", required_argument, NULL, 'Y' },
+        { "skim-lines", required_argument, NULL, 'J' },
+        { "skim-bytes", required_argument, NULL, 'Z' },
+        { "colorize", no_argument, NULL, 'C' },
+        { "collapse", optional_argument, NULL, 'D' },
+        { "mask", no_argument, NULL, 'Q' },
+        { NULL, 0, NULL, 0 }
+    };
+    char speed[20], position[3], *filename_nodashf;
+    unsigned int scroll_speed = topt.default_speed; 
+    char *progname = argv[0];
+
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+
+    if (progname) {
+        filename_nodashf = argv[1];
+    }
+
+    for (opt = 1; opt < argc; opt++) {
+        if (!strncmp(argv[opt], "-", 1)) {
+            break;
+        } else { /* no options just filename */
+            tfile.piped = FALSE;
+
+            if (strlen(argv[opt]) > BUFMAX) {
+                usage(progname);
+            }
+
+            if (!(tfile.filename = (char *)malloc(strlen(argv[opt])+1))) {
+                my_perror("malloc()");
+            }
+
+            strncpy(tfile.filename, argv[opt], strlen(argv[opt]));
+
+            if (!(tfile.fp = fopen(tfile.filename, "r"))) {
+                my_perror("fopen()");
+            }
+        }
+    }
+
+    while ((optch = getopt_long(argc, argv, optstring, longopts, NULL)) != -1) {
+        switch (optch) {
+            case 's':
+                if (!char_check(optarg)) {
+                    usage(progname);
+                }
+                strncpy(speed, optarg, 20);
+                scroll_speed = (unsigned int)atoi(speed);
+                tresume.speed_given = TRUE;
+                break;
+            case 'p':
+                if (!char_check(optarg)) {
+                    usage(progname);
+                }
+                strncpy(position, optarg, 3);
+                topt.pos_changed = (unsigned int)atoi(position);
+                break;
+            case 'f':
+                tfile.piped = FALSE;
+                if (strlen(optarg) > BUFMAX) {
+                    usage(progname);
+                }
+                if (!(tfile.filename = (char *)malloc(strlen(optarg)+1))) {
+                    my_perror("malloc()");
+                }
+                strncpy(tfile.filename, optarg, strlen(optarg));
+                if (!(tfile.fp = fopen(tfile.filename, "r"))) {
+                    my_perror("fopen()"); 
+                }
+                break;
+            case 't':
+                if (tmirror.ttys == MIRROR_MAX) {
+                    usage(progname);
+                }
+                tmirror.tty_name[tmirror.ttys++] = optarg;
+                if (!tfile.tty_name) {
+                    tfile.tty_name = optarg;
+                }
+                break;
+            case 'w':
+                if (strlen(optarg) > BUFMAX) {
+                    usage(progname);
+                }
+                if (!(topt.special_word = (char *)malloc(strlen(optarg)+1))) {
+                    my_perror("malloc()");
+                }
+                strncpy(topt.special_word, optarg, strlen(optarg) + 1);
+                topt.word_given = TRUE;
+                break;
+            case 'n':
+                topt.view_normal = TRUE;
+                break;
+            case 'i':
+                topt.ignore_case = TRUE;
+                break;
+            case 'u':
+                topt.case_type = UPPERCASE;
+                topt.case_change = TRUE;
+                break;
+            case 'l':
+                topt.case_type = LOWERCASE;
+                topt.case_change = TRUE; 
+                break; 
+            case 'c':
+                topt.want_color = 1;
+                if (!(topt.use_color = (char *)malloc(strlen(optarg)+1))) {
+                    my_perror("malloc");
+                }
+                strncpy(topt.use_color, optarg, strlen(optarg));
+                break;
+            case 'x':
+                topt.statusbar = FALSE;
+                break;
+            case 'v':
+                endwin();
+                printf("textscroll -Ryan Kulla\n");
+                exit(EXIT_SUCCESS);
+                break;
+            case 'h':
+                usage(progname);
+                break;
+            case 'a':
+                topt.auto_pause = TRUE;
+                break;
+            case 'm':
+                topt.scrollmode_chars = TRUE;
+                break;
+            case 'b':
+                topt.beep_ok = TRUE;
+                break;
+            case 'B':
+                if (!char_check(optarg)) {
+                    usage(progname);
+                }
+                topt.bandwidth = strtoul(optarg, NULL, 10);
+                break;
+            case 'K':
+                topt.benchmark = TRUE;
+                break;
+            case 'E':
+                texport.active = TRUE;
+                break;
+            case 'H':
+                thscroll.active = TRUE;
+                break;
+            case 'L':
+                if (!(tlat.script = fopen(optarg, "r"))) {
+                    my_perror(optarg);
+                }
+                tlat.active = TRUE;
+                break;
+            case 'Y':
+                if ((tlat.max = strtod(optarg, NULL)) <= 0) {
+                    usage(progname);
+                }
+                break;
+            case 'C':
+                topt.colorize = TRUE;
+                break;
+            case 'D':
+                tcollapse.active = TRUE;
+                if (optarg && (!char_check(optarg) || 
+                    (tcollapse.window = atoi(optarg)) < 1 ||
+                    tcollapse.window > COLLAPSE_MAX)) {
+                    usage(progname);
+                }
+                break;
+            case 'Q':
+                tcollapse.active = tcollapse.mask = TRUE;
+                break;
+            case 'J':
+                if (!char_check(optarg) || tskim.active ||
+                    !(tskim.lines = strtoul(optarg, NULL, 10))) {
+                    usage(progname);
+                }
+                tskim.active = TRUE;
+                break;
+            case 'Z':
+                if (tskim.active || !(tskim.stride = parse_size(optarg))) {
+                    usage(progname);
+                }
+                tskim.active = TRUE;
+                break;
+            case 'W':
+                if (!char_check(optarg) || !(trsvp.wpm = atoi(optarg))) {
+                    usage(progname);
+                }
+                trsvp.active = TRUE;
+                break;
+            case 'N':
+                if (!char_check(optarg) || !(trsvp.words = atoi(optarg)) ||
+                    trsvp.words > RSVP_MAX_WORDS) {
+                    usage(progname);
+                }
+                break;
+            case 'P':
+                trep.active = TRUE;
+                if (optarg && (trep.mult = strtod(optarg, NULL)) <= 0) {
+                    usage(progname);
+                }
+                break;
+            case 'G':
+                if ((trep.max_gap = strtod(optarg, NULL)) < 0) {
+                    usage(progname);
+                }
+                break;
+            case 'R':
+                if (strlen(optarg) > BUFMAX) {
+                    usage(progname);
+                }
+                tfile.piped = FALSE;
+                trot.pattern = tfile.filename = optarg;
+                break;
+            case 'X':
+                if (strlen(optarg) > BUFMAX) {
+                    usage(progname);
+                }
+                tfile.piped = FALSE;
+                pane_add(optarg);
+                break;
+            case 'M':
+                if ((tpipe.mem.cap = parse_size(optarg)) < PIPE_CHUNK) {
+                    usage(progname);
+                }
+                break;
+            case 'S':
+                tpipe.spill.cap = parse_size(optarg);
+                if (tpipe.spill.cap && tpipe.spill.cap < PIPE_CHUNK) {
+                    usage(progname);
+                }
+                break;
+            case 'U':
+                if ((tpack.cap = parse_size(optarg)) < PIPE_CHUNK) {
+                    usage(progname);
+                }
+                break;
+            case 'F':
+                tresume.active = TRUE;
+                break;
+            case 'T':
+                if (strlen(optarg) >= 
+                    sizeof(((struct sockaddr_un *)0)->sun_path)) {
+                    usage(progname);
+                }
+                tctl.path = optarg;
+                break;
+            case 'V':
+                if ((tahead.size = parse_size(optarg)) < BUFMAX) {
+                    usage(progname);
+                }
+                break;
+            default:
+                usage(progname);
+                break;
+        }
+    }
+
+    if (trsvp.active && tfile.piped) { /* the word index needs a file */
+        usage(progname);
+    }
+
+    if (texport.active && tpanes.count) {
+        usage(progname);
+    }
+
+    if (tlat.active && (tfile.piped || texport.active || topt.benchmark)) {
+        usage(progname); /* the script is the only input */
+    }
+
+    /* skimming seeks around the file as it is on disk */
+    if (tskim.active && (tfile.piped || trot.pattern || trsvp.active || 
+                         tpanes.count || texport.active)) {
+        usage(progname);
+    }
+
+    /* the panes have keys of their own; the rest never read any */
+    if (tctl.path && (tpanes.count || texport.active || topt.benchmark ||
+                      tlat.active)) {
+        usage(progname);
+    }
+
+    /* the word index and the samples don't go line by line */
+    if (tcollapse.active && (trsvp.active || tskim.active || tpanes.count)) {
+        usage(progname);
+    }
+
+    /* it reads ahead of a file scrolled a line at a time */
+    if (tahead.size && (tfile.piped || tskim.active || trsvp.active || 
+                        tpanes.count || texport.active || topt.benchmark)) {
+        usage(progname);
+    }
+
+    do_options(scroll_speed, argc, filename_nodashf, progname);
+}
+
+void text_colors(void)
+{
+    if (has_colors() == FALSE) {
+        cperror("Your terminal does not support colors");
+    }
+
+    start_color();
+
+    if (!strncmp(topt.use_color, "red", 3)) 
+        assume_default_colors(COLOR_RED, COLOR_BLACK);
+    if (!strncmp(topt.use_color, "bgred", 5))
+        assume_default_colors(COLOR_WHITE, COLOR_RED);
+    if (!strncmp(topt.use_color, "bgblue", 6))
+        assume_default_colors(COLOR_WHITE, COLOR_BLUE);
+    if (!strncmp(topt.use_color, "blue", 4))
+        assume_default_colors(COLOR_BLUE, COLOR_BLACK);
+    if (!strncmp(topt.use_color, "green", 5))
+        assume_default_colors(COLOR_GREEN, COLOR_BLACK);
+    if (!strncmp(topt.use_color, "bggreen", 7))
+        assume_default_colors(COLOR_BLUE, COLOR_GREEN);
+    if (!strncmp(topt.use_color, "magenta", 7))
+        assume_default_colors(COLOR_MAGENTA, COLOR_BLACK);
+    if (!strncmp(topt.use_color, "bgmagenta", 9)) 
+        assume_default_colors(COLOR_WHITE, COLOR_MAGENTA);
+    if (!strncmp(topt.use_color, "yellow", 6))
+        assume_default_colors(COLOR_YELLOW, COLOR_BLACK);
+    if (!strncmp(topt.use_color, "bgyellow", 8))
+        assume_default_colors(COLOR_WHITE, COLOR_YELLOW);
+    if (!strncmp(topt.use_color, "bgwhite", 7))
+        assume_default_colors(COLOR_BLACK, COLOR_WHITE);
+    if (!strncmp(topt.use_color, "bgblack", 7))
+        assume_default_colors(COLOR_WHITE, COLOR_BLACK);
+}
+
+void do_options(unsigned int scroll_speed, int argc, char *filename_nodashf,
+                char *progname)
+{
+
+    if (!topt.special_word) {
+        topt.special_word = "textscroll";
+    }
+
+    init_case_tables();
+
+    if (tlat.active) { /* before any threads are started */
+        latency_pty();
+        tlat.start = mono_now();
+        latency_next();
+    }
+
+    if (texport.active) {
+        export_text();
+        return;
+    }
+
+    if (tpanes.count) {
+        if (!scroll_speed) {
+            usage(progname);
+        }
+
+        pane_setup(scroll_speed);
+        pane_scroll(scroll_speed);
+        return;
+    }
+
+    /* only a single file scrolled line by line can be picked up again */
+    if (!tfile.piped && !tskim.active && !trot.pattern && !trsvp.active &&
+        !topt.benchmark && !tlat.active) {
+        resume_setup();
+    }
+
+    if (tfile.piped) {
+        tfile.filename = tfile.text_pipe;
+        check_stdin();
+    } else if (tskim.active) {
+        /* no preprocessing, it would read the whole file */
+    } else if (tresume.active && resume_load()) {
+        /* the text is back as it was scrolled */
+    } else if (trot.pattern) {
+        rotated_stream();
+    } else if ((!check_if_pdf(tfile.filename) || !pdf_stream()) &&
+               (!check_if_archive(tfile.filename) || !archive_stream())) {
+        text_stream(); /* Call external dependenies */
+    }
+
+    if (topt.benchmark && !tfile.piped) {
+        benchmark();
+        return;
+    }
+
+    create_windows();
+    mirror_setup();
+    
+    if (tfile.filename) {
+        tfile.display_filename = str_trunc(get_basename(tfile.filename), 15);
+    }
+
+
+    if (scroll_speed) {
+         scroll_it(scroll_speed, argc, filename_nodashf, progname);
+    } else {
+        usage(progname);
+    }
+}
+
+/* filename in single quotes for the shell, with any ' in it as '\'' so
+   nothing inside gets expanded */
+char *shell_quote(char *dst, size_t size, char *filename)
+{
+    size_t n = 0;
+
+    if (size < 3) {
+        errno = ENAMETOOLONG;
+        my_perror(filename);
+    }
+
+    dst[n++] = '\'';
+
+    for (; *filename; filename++) {
+        if (n + (*filename == '\'' ? 4 : 1) + 2 > size) {
+            errno = ENAMETOOLONG;
+            my_perror(filename);
+        }
+
+        if (*filename == '\'') {
+            memcpy(dst + n, "'\\''", 4);
+            n += 4;
+        } else {
+            dst[n++] = *filename;
+        }
+    }
+
+    dst[n++] = '\'';
+    dst[n] = '\0';
+
+    return dst;
+}
+
+void lesspipe(char *filename, char *text_file)
+{
+    FILE *fp_read, *fp_write;
+    char *c, buf[BUFMAX], command[BUFMAX], lesscommand[BUFMAX], *lesspipe;
+    unsigned long int empty = 0;
+    char qfilename[BUFMAX]; /* quoted filename */
+
+    /* a run that was killed can leave text_file behind */
+    close(open(text_file, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+
+    /* $LESSOPEN will look like:  |/usr/bin/lesspipe.sh %s */
+    lesspipe = getenv("LESSOPEN");
+
+    /* strip off the leading | */ 
+    if (lesspipe && (c = strchr(lesspipe, '|'))) {
+        /* redirection, pdftotext needs the - */
+        snprintf(lesscommand, sizeof lesscommand, "%s%s%s", c + 1, 
+            check_if_pdf(filename) ? " - > " : " > ", text_file);
+
+        /* quote filenames containing spaces, $ and the like: */
+        shell_quote(qfilename, sizeof qfilename, filename);
+        snprintf(command, sizeof command, lesscommand, qfilename);
+
+        system(command); /* run lesspipe.sh */
+    }
+
+    if (!(fp_write = fopen(text_file, "r"))) {
+        my_perror("fopen()");
+    }
+
+    if (file_size(fp_write) == 0) {
+        empty = 1;
+    }
+
+    fclose(fp_write);
+
+    if (empty) {
+
+        /* lesspipe didn't have any output, make the file ourselves */
+        if (!(fp_read = fopen(filename, "r"))) {
+            my_perror("fopen()");
+        }
+
+        if (!(fp_write = fopen(text_file, "w"))) {
+            my_perror("fopen()");
+        }
+
+        while (fgets(buf, sizeof buf, fp_read)) {
+            fprintf(fp_write, "%s", buf);
+        }
+
+        fclose(fp_read);
+        fclose(fp_write);
+    }
+}
+
+int check_if_pdf(char *filename)
+{
+    char *c;
+
+    if (strstr(filename, ".pdf")) {
+        if ((c = strrchr(filename, '.'))) {
+            if (!strncmp(c, ".pdf", 4)) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Start converting the PDF page range by page range. The first range
+   is done before returning so there's something to show; the rest is
+   appended to text_file in the background. Returns 0 if the poppler
+   tools aren't there and lesspipe should handle it instead. */
+int pdf_stream(void)
+{
+    FILE *fp;
+    char command[BUFMAX * 2], buf[BUFMAX], qfilename[BUFMAX];
+
+    snprintf(command, sizeof command, "pdfinfo %s 2>/dev/null", 
+        shell_quote(qfilename, sizeof qfilename, tfile.filename));
+
+    if (!(fp = popen(command, "r"))) {
+        return 0;
+    }
+
+    while (fgets(buf, sizeof buf, fp)) {
+        if (!strncmp(buf, "Pages:", 6)) {
+            tpdf.pages = strtoul(buf + 6, NULL, 10);
+        }
+    }
+
+    if (pclose(fp) != 0 || !tpdf.pages) {
+        return 0;
+    }
+
+    tpdf.out = text_output();
+
+    if (!(tpdf.page_start = (off_t *)calloc(tpdf.pages + 1, sizeof(off_t)))) {
+        my_perror("calloc()");
+    }
+
+    tpdf.active = TRUE;
+    tfile.growing = TRUE;
+
+    if (!pdf_range(1, PDF_RANGE)) {
+        my_perror("pdftotext");
+    }
+
+    if (pthread_create(&tpdf.extractor, NULL, pdf_extractor, NULL) != 0) {
+        my_perror("pthread_create()");
+    }
+
+    pthread_detach(tpdf.extractor);
+
+    return 1;
+}
+
+/* Convert pages first to last, wrapped and with extra blank lines taken
+   out like the rest of the preprocessing does. pdftotext ends every page
+   with a form feed, which is how page_start gets filled in. */
+int pdf_range(unsigned long int first, unsigned long int last)
+{
+    FILE *fp;
+    char command[BUFMAX * 2], buf[BUFMAX], qfilename[BUFMAX], *c;
+    unsigned long int page = first;
+
+    if (last > tpdf.pages) {
+        last = tpdf.pages;
+    }
+
+    snprintf(command, sizeof command, 
+        "pdftotext -q -f %lu -l %lu %s - | fmt -s", first, last, 
+        shell_quote(qfilename, sizeof qfilename, tfile.filename));
+
+    if (!(fp = popen(command, "r"))) {
+        return 0;
+    }
+
+    tpdf.page_start[page - 1] = tpdf.written;
+
+    while (fgets(buf, sizeof buf, fp)) {
+        if (!topt.view_normal && squeeze_blank(buf, &tpdf.blank)) {
+            continue;
+        }
+
+        fputs(buf, tpdf.out);
+        tpdf.written += strlen(buf);
+
+        for (c = buf; (c = strchr(c, '\f')); c++) {
+            if (page < last) {
+                tpdf.page_start[page] = tpdf.written;
+            }
+            page++;
+        }
+    }
+
+    fflush(tpdf.out);
+    tpdf.extracted = last;
+
+    return pclose(fp) == 0;
+}
+
+void *pdf_extractor(void *arg)
+{
+    unsigned long int first;
+
+    for (first = PDF_RANGE + 1; first <= tpdf.pages; first += PDF_RANGE) {
+        if (!pdf_range(first, first + PDF_RANGE - 1)) {
+            break;
+        }
+    }
+
+    fclose(tpdf.out);
+    tfile.growing = FALSE;
+
+    return NULL;
+}
+
+/* which page the text at offset came from */
+unsigned long int pdf_page_at(off_t offset)
+{
+    unsigned long int lo = 0, hi = tpdf.extracted, mid;
+
+    while (lo + 1 < hi) {
+        mid = (lo + hi) / 2;
+
+        if (tpdf.page_start[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo + 1;
+}
+
+int check_if_archive(char *filename)
+{
+    char *c;
+
+    if (!(c = strrchr(filename, '.'))) {
+        return 0;
+    }
+
+    if (!strcmp(c, ".tar")) {
+        return ARCHIVE_TAR;
+    }
+
+    if (!strcmp(c, ".tgz") || (!strcmp(c, ".gz") && c - filename > 4 && 
+        !strncmp(c - 4, ".tar", 4))) {
+        return ARCHIVE_TGZ;
+    }
+
+    if (!strcmp(c, ".zip") || !strcmp(c, ".jar")) {
+        return ARCHIVE_ZIP;
+    }
+
+    return 0;
+}
+
+/* Start decoding the archive's members on a pool of threads. Returns
+   once the first text is in text_file so there's something to show;
+   the rest is appended in the background. Returns 0 if it doesn't look
+   like a tar or zip after all and lesspipe should handle it instead. */
+int archive_stream(void)
+{
+    char head[512];
+    unsigned int i;
+    long cpus;
+
+    tarc.type = check_if_archive(tfile.filename);
+
+    if ((tarc.fd = open(tfile.filename, O_RDONLY)) < 0) {
+        my_perror("open()");
+    }
+
+    if (tarc.type == ARCHIVE_TGZ && !(tarc.gz = gzdopen(dup(tarc.fd), "rb"))) {
+        my_perror("gzdopen()");
+    }
+
+    if (tarc.type == ARCHIVE_ZIP) {
+        if (pread(tarc.fd, head, 4, 0) != 4 || memcmp(head, "PK\3\4", 4)) {
+            close(tarc.fd);
+            return 0;
+        }
+    } else if (!archive_read(head, sizeof head, 0) || 
+               memcmp(head + 257, "ustar", 5)) {
+        if (tarc.gz) {
+            gzclose(tarc.gz);
+            tarc.gz = NULL;
+        }
+        close(tarc.fd);
+        return 0;
+    }
+
+    if (tarc.gz) {
+        gzrewind(tarc.gz);
+    }
+
+    tarc.out = text_output();
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    tarc.workers = cpus < 1 ? 1 : cpus > ARCHIVE_WORKERS ? ARCHIVE_WORKERS : cpus;
+    tarc.workers = tarc.gz ? 0 : tarc.workers; /* the lister decodes those */
+    tarc.active = TRUE;
+    tfile.growing = TRUE;
+
+    if (pthread_create(&tarc.lister, NULL, archive_lister, NULL) != 0 ||
+        pthread_create(&tarc.writer, NULL, archive_writer, NULL) != 0) {
+        my_perror("pthread_create()");
+    }
+
+    pthread_detach(tarc.lister);
+    pthread_detach(tarc.writer);
+
+    for (i = 0; i < tarc.workers; i++) {
+        if (pthread_create(&tarc.worker[i], NULL, archive_worker, NULL) != 0) {
+            my_perror("pthread_create()");
+        }
+        pthread_detach(tarc.worker[i]);
+    }
+
+    pthread_mutex_lock(&tarc.lock);
+    while (!tarc.written_bytes && tfile.growing) {
+        pthread_cond_wait(&tarc.cond, &tarc.lock);
+    }
+    pthread_mutex_unlock(&tarc.lock);
+
+    return 1;
+}
+
+/* len bytes of a tar at pos; a tar.gz can only be read front to back */
+int archive_read(char *buf, unsigned long long len, off_t pos)
+{
+    ssize_t n;
+    int chunk;
+
+    while (len) {
+        if (tarc.gz) {
+            chunk = len > (1U << 30) ? (1U << 30) : len;
+            n = gzread(tarc.gz, buf, chunk);
+        } else {
+            n = pread(tarc.fd, buf, len, pos);
+        }
+
+        if (n <= 0) {
+            return 0;
+        }
+
+        buf += n;
+        pos += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+/* hand a member to the workers, in archive order */
+void archive_add(struct archive_member *m)
+{
+    pthread_mutex_lock(&tarc.lock);
+
+    if (tarc.count == tarc.alloced) {
+        tarc.alloced = tarc.alloced ? tarc.alloced * 2 : 256;
+        tarc.member = (struct archive_member **)realloc(tarc.member, 
+            tarc.alloced * sizeof *tarc.member);
+        if (!tarc.member) {
+            my_perror("realloc()");
+        }
+    }
+
+    tarc.member[tarc.count++] = m;
+    pthread_cond_broadcast(&tarc.cond);
+    pthread_mutex_unlock(&tarc.lock);
+}
+
+void list_tar(void)
+{
+    char head[512], longname[BUFMAX] = "";
+    unsigned long long size, taken;
+    off_t pos = 0, next;
+    struct archive_member *m;
+
+    while (archive_read(head, sizeof head, pos) && head[0]) {
+        pos += sizeof head;
+        head[135] = '\0';
+        size = strtoull(head + 124, NULL, 8);
+        next = pos + ((size + 511) & ~511ULL); /* data fills whole blocks */
+        taken = 0;
+
+        if (head[156] == 'L') {        /* GNU long name for the next one */
+            if (size >= sizeof longname || !archive_read(longname, size, pos)) {
+                break;
+            }
+            longname[size] = '\0';
+            taken = size;
+        } else if (head[156] == '0' || head[156] == '\0' || head[156] == '7') {
+            if (!(m = (struct archive_member *)calloc(1, sizeof *m))) {
+                my_perror("calloc()");
+            }
+
+            if (longname[0]) {
+                snprintf(m->name, sizeof m->name, "%s", longname);
+            } else if (head[345]) {
+                snprintf(m->name, sizeof m->name, "%.155s/%.100s", head + 345,
+                    head);
+            } else {
+                snprintf(m->name, sizeof m->name, "%.100s", head);
+            }
+
+            longname[0] = '\0';
+            m->offset = pos;
+            m->csize = m->usize = size;
+
+            archive_add(m);
+
+            if (tarc.gz) {
+                taken = archive_decode(m); /* it has to be read in order */
+            }
+        }
+
+        /* a tar.gz is read as it goes, so skip what wasn't */
+        if (tarc.gz && gzseek(tarc.gz, next - pos - taken, SEEK_CUR) < 0) {
+            break;
+        }
+
+        pos = next;
+    }
+}
+
+/* little endian fields of the zip headers */
+#define LE16(p) ((unsigned int)(p)[0] | (unsigned int)(p)[1] << 8)
+#define LE32(p) (LE16(p) | (unsigned long)LE16((p) + 2) << 16)
+#define LE64(p) (LE32(p) | (unsigned long long)LE32((p) + 4) << 32)
+#define ZIP64 0xFFFFFFFFULL /* the size or offset is in the zip64 extra */
+
+void list_zip(void)
+{
+    unsigned char tail[65557], *cd, *p, local[30], end64[56];
+    off_t size, start;
+    unsigned long long cd_size, cd_offset, csize, usize, at;
+    unsigned int n, name_len, extra_len;
+    ssize_t got;
+    struct archive_member *m;
+
+    size = lseek(tarc.fd, 0, SEEK_END);
+    start = size > (off_t)sizeof tail ? size - (off_t)sizeof tail : 0;
+
+    if ((got = pread(tarc.fd, tail, size - start, start)) < 22) {
+        return;
+    }
+
+    /* the end of central directory record, behind any comment */
+    for (p = tail + got - 22; p >= tail && LE32(p) != 0x06054b50; p--)
+        ;
+
+    if (p < tail) {
+        return;
+    }
+
+    cd_size = LE32(p + 12);
+    cd_offset = LE32(p + 16);
+
+    /* a zip64 archive has a locator just in front, pointing at its own
+       end record with the sizes that didn't fit */
+    if (p - tail >= 20 && LE32(p - 20) == 0x07064b50) {
+        if (pread(tarc.fd, end64, sizeof end64, LE64(p - 20 + 8)) != 
+            sizeof end64 || LE32(end64) != 0x06064b50) {
+            zip_broken("zip64 end of central directory record not found");
+            return;
+        }
+
+        cd_size = LE64(end64 + 40);
+        cd_offset = LE64(end64 + 48);
+    } else if (cd_size == ZIP64 || cd_offset == ZIP64) {
+        zip_broken("zip64 end of central directory locator not found");
+        return;
+    }
+
+    if (!(cd = (unsigned char *)malloc(cd_size))) {
+        my_perror("malloc()");
+    }
+
+    if (pread(tarc.fd, cd, cd_size, cd_offset) != (ssize_t)cd_size) {
+        free(cd);
+        zip_broken("central directory cut short");
+        return;
+    }
+
+    for (p = cd; p + 46 <= cd + cd_size && LE32(p) == 0x02014b50;
+         p += 46 + LE16(p + 28) + LE16(p + 30) + LE16(p + 32)) {
+        name_len = LE16(p + 28);
+        extra_len = LE16(p + 30);
+
+        if (p + 46 + name_len + extra_len > cd + cd_size || 
+            p[46 + name_len - 1] == '/') {
+            continue; /* a directory */
+        }
+
+        if (!(m = (struct archive_member *)calloc(1, sizeof *m))) {
+            my_perror("calloc()");
+        }
+
+        n = name_len < sizeof m->name ? name_len : sizeof m->name - 1;
+        memcpy(m->name, p + 46, n);
+        m->method = LE16(p + 10);
+        csize = LE32(p + 20);
+        usize = LE32(p + 24);
+        at = LE32(p + 42);
+
+        if ((csize == ZIP64 || usize == ZIP64 || at == ZIP64) &&
+            !zip64_extra(p + 46 + name_len, extra_len, &usize, &csize, &at)) {
+            m->problem = "zip64 sizes missing";
+            archive_add(m);
+            continue;
+        }
+
+        m->csize = csize;
+        m->usize = usize;
+
+        /* the local header's name and extra field can differ in length */
+        if (pread(tarc.fd, local, sizeof local, at) != sizeof local) {
+            free(m);
+            break;
+        }
+
+        m->offset = at + sizeof local + LE16(local + 26) + LE16(local + 28);
+        archive_add(m);
+    }
+
+    free(cd);
+}
+
+/* say so in the text, not leave an empty screen */
+void zip_broken(char *why)
+{
+    struct archive_member *m;
+
+    if (!(m = (struct archive_member *)calloc(1, sizeof *m))) {
+        my_perror("calloc()");
+    }
+
+    snprintf(m->name, sizeof m->name, "%s", tfile.filename);
+    m->problem = why;
+    archive_add(m);
+}
+
+/* Fill in what a zip64 entry left as ZIP64 from its extra field, which
+   has them in this order. Returns 0 if the field is missing or short. */
+int zip64_extra(unsigned char *p, unsigned int len, unsigned long long *usize,
+                unsigned long long *csize, unsigned long long *at)
+{
+    unsigned long long *field[3];
+    unsigned char *end = p + len;
+    unsigned int i;
+
+    field[0] = usize;
+    field[1] = csize;
+    field[2] = at;
+
+    for (; p + 4 <= end && LE16(p) != 0x0001; p += 4 + LE16(p + 2))
+        ;
+
+    if (p + 4 > end || p + 4 + LE16(p + 2) > end) {
+        return 0;
+    }
+
+    end = p + 4 + LE16(p + 2);
+
+    for (p += 4, i = 0; i < 3; i++) {
+        if (*field[i] == ZIP64) {
+            if (p + 8 > end) {
+                return 0;
+            }
+            *field[i] = LE64(p);
+            p += 8;
+        }
+    }
+
+    return 1;
+}
+
+void *archive_lister(void *arg)
+{
+    if (tarc.type == ARCHIVE_ZIP) {
+        list_zip();
+    } else {
+        list_tar();
+    }
+
+    pthread_mutex_lock(&tarc.lock);
+    tarc.listed = TRUE;
+    pthread_cond_broadcast(&tarc.cond);
+    pthread_mutex_unlock(&tarc.lock);
+
+    return NULL;
+}
+
+void *archive_worker(void *arg)
+{
+    struct archive_member *m;
+
+    for (;;) {
+        pthread_mutex_lock(&tarc.lock);
+
+        /* don't get too far ahead of what's been written */
+        while ((tarc.next >= tarc.count && !tarc.listed) || 
+               (tarc.next < tarc.count && 
+                tarc.next - tarc.written >= tarc.workers * 2)) {
+            pthread_cond_wait(&tarc.cond, &tarc.lock);
+        }
+
+        if (tarc.next >= tarc.count) {
+            pthread_mutex_unlock(&tarc.lock);
+            return NULL;
+        }
+
+        m = tarc.member[tarc.next++];
+        pthread_mutex_unlock(&tarc.lock);
+
+        archive_decode(m);
+    }
+}
+
+/* Turn a member into text: inflate it if the zip deflated it, gunzip
+   it if it's a .gz itself, and put a header line in front. It goes
+   through ARCHIVE_IN at a time and on to the writer ARCHIVE_CHUNK at a
+   time, so a huge member takes no more memory than a small one.
+   Returns how much of it was read. */
+unsigned long long archive_decode(struct archive_member *m)
+{
+    char in[ARCHIVE_IN], *c;
+    z_stream zs[2];
+    unsigned long long left = m->csize, n;
+    off_t pos = m->offset;
+    int stages = 0, more = TRUE, i;
+
+    if (!(m->text = (char *)malloc(ARCHIVE_CHUNK + 1))) {
+        my_perror("malloc()");
+    }
+
+    m->head = m->text_len = sprintf(m->text, "==> %s <==\n", m->name);
+    memset(zs, 0, sizeof zs);
+
+    if (m->problem || (tarc.type == ARCHIVE_ZIP && m->method != 0 && 
+                       m->method != 8)) {
+        if (m->problem) {
+            m->text_len += sprintf(m->text + m->text_len, "[%s]\n", 
+                m->problem);
+        } else {
+            m->text_len += sprintf(m->text + m->text_len, 
+                "[compression method %u not supported]\n", m->method);
+        }
+        m->head = m->text_len;
+        left = 0;
+    }
+
+    if (tarc.type == ARCHIVE_ZIP && m->method == 8 &&
+        inflateInit2(&zs[stages++], -MAX_WBITS) != Z_OK) {
+        my_perror("inflateInit2()");
+    }
+
+    if ((c = strrchr(m->name, '.')) && !strcmp(c, ".gz") &&
+        inflateInit2(&zs[stages++], MAX_WBITS + 16) != Z_OK) {
+        my_perror("inflateInit2()");
+    }
+
+    while (left && more) {
+        n = left < sizeof in ? left : sizeof in;
+
+        if (!archive_read(in, n, pos)) {
+            break;
+        }
+
+        pos += n;
+        left -= n;
+        more = archive_push(m, zs, stages, in, n);
+    }
+
+    for (i = 0; i < stages; i++) {
+        inflateEnd(&zs[i]);
+    }
+
+    archive_end(m);
+
+    return m->csize - left;
+}
+
+/* Push len bytes through the rest of a member's stages: each inflates
+   into the next and the last hands its text on. Returns 0 once one has
+   reached its end or found the data damaged. */
+int archive_push(struct archive_member *m, z_stream *zs, int stages, 
+                 char *buf, unsigned long long len)
+{
+    char out[ARCHIVE_IN];
+    int ret;
+
+    if (!stages) {
+        archive_emit(m, buf, len);
+        return 1;
+    }
+
+    zs->next_in = (Bytef *)buf;
+    zs->avail_in = len;
+
+    do {
+        zs->next_out = (Bytef *)out;
+        zs->avail_out = sizeof out;
+        ret = inflate(zs, Z_NO_FLUSH);
+
+        if (!archive_push(m, zs + 1, stages - 1, out, 
+                          sizeof out - zs->avail_out)) {
+            return 0;
+        }
+    } while (ret == Z_OK && (zs->avail_in || !zs->avail_out));
+
+    return ret == Z_OK || ret == Z_BUF_ERROR; /* a damaged member still 
+                                                 shows what's good */
+}
+
+/* add decoded text to a member, handing it over whenever it's full */
+void archive_emit(struct archive_member *m, char *buf, unsigned long long len)
+{
+    unsigned long long part;
+
+    if (len) {
+        m->last = buf[len - 1];
+    }
+
+    m->body += len;
+
+    while (len && !m->binary) {
+        if (m->text_len == ARCHIVE_CHUNK) {
+            archive_hand(m);
+        }
+
+        part = ARCHIVE_CHUNK - m->text_len;
+        part = len < part ? len : part;
+        memcpy(m->text + m->text_len, buf, part);
+        m->text_len += part;
+        buf += part;
+        len -= part;
+
+        if (!m->sniffed && m->text_len - m->head >= 8192) {
+            archive_sniff(m);
+        }
+    }
+}
+
+/* a NUL near the start means it isn't text, and only its size is shown */
+void archive_sniff(struct archive_member *m)
+{
+    unsigned long long len = m->text_len - m->head;
+
+    m->sniffed = TRUE;
+
+    if (memchr(m->text + m->head, '\0', len < 8192 ? len : 8192)) {
+        m->binary = TRUE;
+        m->text_len = m->head;
+    }
+}
+
+/* wait while the writer takes a member's text */
+void archive_hand(struct archive_member *m)
+{
+    pthread_mutex_lock(&tarc.lock);
+    m->full = TRUE;
+    pthread_cond_broadcast(&tarc.cond);
+
+    while (m->full) {
+        pthread_cond_wait(&tarc.cond, &tarc.lock);
+    }
+
+    pthread_mutex_unlock(&tarc.lock);
+}
+
+/* finish a member's text and let the writer have the rest of it */
+void archive_end(struct archive_member *m)
+{
+    if (!m->sniffed) {
+        archive_sniff(m);
+    }
+
+    while (m->text_len + 64 > ARCHIVE_CHUNK) {
+        archive_hand(m);
+    }
+
+    if (m->binary) {
+        m->text_len += sprintf(m->text + m->text_len, "[binary, %llu bytes]\n", 
+            m->body);
+    } else if (m->body && m->last != '\n') {
+        m->text[m->text_len++] = '\n';
+    }
+
+    m->text[m->text_len++] = '\n';
+
+    pthread_mutex_lock(&tarc.lock);
+    m->done = TRUE;
+    pthread_cond_broadcast(&tarc.cond);
+    pthread_mutex_unlock(&tarc.lock);
+}
+
+/* append members to text_file, first to last, as their text comes */
+void *archive_writer(void *arg)
+{
+    struct archive_member *m;
+    unsigned long int i;
+    unsigned int done;
+    off_t n;
+
+    for (i = 0; ; i++) {
+        pthread_mutex_lock(&tarc.lock);
+        while (i >= tarc.count && !tarc.listed) {
+            pthread_cond_wait(&tarc.cond, &tarc.lock);
+        }
+
+        if (i >= tarc.count) {
+            pthread_mutex_unlock(&tarc.lock);
+            break;
+        }
+
+        m = tarc.member[i];
+        m->start = tarc.written_bytes;
+
+        do {
+            while (!m->full && !m->done) {
+                pthread_cond_wait(&tarc.cond, &tarc.lock);
+            }
+
+            done = m->done;
+            pthread_mutex_unlock(&tarc.lock);
+
+            n = archive_write(m, done);
+
+            pthread_mutex_lock(&tarc.lock);
+            tarc.written_bytes += n;
+            m->full = FALSE;
+            pthread_cond_broadcast(&tarc.cond);
+        } while (!done);
+
+        tarc.written++;
+        pthread_mutex_unlock(&tarc.lock);
+
+        free(m->text);
+        m->text = NULL;
+    }
+
+    fclose(tarc.out);
+
+    if (tarc.gz) {
+        gzclose(tarc.gz);
+    }
+
+    pthread_mutex_lock(&tarc.lock);
+    tfile.growing = FALSE;
+    pthread_cond_broadcast(&tarc.cond);
+    pthread_mutex_unlock(&tarc.lock);
+
+    return NULL;
+}
+
+/* Write out the whole lines of a member's text, or all of it once it's
+   done or one line fills it, keeping the rest. Returns bytes written. */
+off_t archive_write(struct archive_member *m, unsigned int all)
+{
+    char *line, *end, *stop = m->text + m->text_len, save;
+    off_t n = 0;
+
+    if (!all && (end = (char *)memrchr(m->text, '\n', m->text_len))) {
+        stop = end + 1;
+    }
+
+    for (line = m->text; line < stop; line = end + 1) {
+        if (!(end = (char *)memchr(line, '\n', stop - line))) {
+            end = stop - 1;
+        }
+
+        save = end[1];
+        end[1] = '\0';
+
+        /* the rest of a line too long to hold isn't a line of its own */
+        if (tarc.partial || topt.view_normal || 
+            !squeeze_blank(line, &tarc.blank)) {
+            fwrite(line, 1, end + 1 - line, tarc.out);
+            n += end + 1 - line;
+        }
+
+        tarc.partial = *end != '\n';
+        end[1] = save;
+    }
+
+    fflush(tarc.out);
+    m->text_len -= stop - m->text;
+    memmove(m->text, stop, m->text_len);
+
+    return n;
+}
+
+/* which member the text at offset came from */
+unsigned long int archive_member_at(off_t offset)
+{
+    unsigned long int lo = 0, hi, mid;
+
+    pthread_mutex_lock(&tarc.lock);
+    hi = tarc.written;
+
+    while (lo + 1 < hi) {
+        mid = (lo + hi) / 2;
+
+        if (tarc.member[mid]->start <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    pthread_mutex_unlock(&tarc.lock);
+
+    return lo + 1;
+}
+
+/* Find the rotation set: a quoted glob as given, or base plus base.N
+   and base.N.gz, ordered oldest first. */
+int rotated_stream(void)
+{
+    glob_t found;
+    char pattern[BUFMAX + 4], *c, *end;
+    unsigned char head[4];
+    struct stat st;
+    unsigned long int i;
+    int fd;
+
+    memset(&found, 0, sizeof found);
+
+    if (strpbrk(trot.pattern, "*?[")) {
+        glob(trot.pattern, 0, NULL, &found);
+    } else {
+        glob(trot.pattern, 0, NULL, &found);
+        snprintf(pattern, sizeof pattern, "%s.*", trot.pattern);
+        glob(pattern, found.gl_pathc ? GLOB_APPEND : 0, NULL, &found);
+    }
+
+    if (!found.gl_pathc) {
+        errno = ENOENT;
+        my_perror(trot.pattern);
+    }
+
+    if (!(trot.seg = (struct rot_segment *)calloc(found.gl_pathc, 
+        sizeof *trot.seg))) {
+        my_perror("calloc()");
+    }
+
+    for (i = 0; i < found.gl_pathc; i++) {
+        c = found.gl_pathv[i];
+
+        if (stat(c, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        /* app.log.3.gz is rotation 3; without a number it's the live log */
+        if (!strpbrk(trot.pattern, "*?[") && strcmp(c, trot.pattern)) {
+            end = c + strlen(trot.pattern) + 1;
+            if (!isdigit((unsigned char)*end)) {
+                continue;
+            }
+            strtoul(end, &end, 10);
+            if (*end && strcmp(end, ".gz")) {
+                continue;
+            }
+        }
+
+        if ((end = strrchr(c, '.')) && !strcmp(end, ".gz")) {
+            while (end > c && isdigit((unsigned char)end[-1])) {
+                end--;
+            }
+        } else {
+            end = c + strlen(c);
+            while (end > c && isdigit((unsigned char)end[-1])) {
+                end--;
+            }
+        }
+
+        if (end > c && end[-1] == '.' && isdigit((unsigned char)*end)) {
+            trot.seg[trot.segments].number = strtoul(end, NULL, 10);
+        }
+
+        if (!(trot.seg[trot.segments].name = strdup(c))) {
+            my_perror("strdup()");
+        }
+
+        trot.seg[trot.segments].mtime = st.st_mtime;
+        trot.seg[trot.segments].estimate = st.st_size;
+
+        /* a gzip's trailer says how big it is uncompressed (mod 4G) */
+        if ((fd = open(c, O_RDONLY)) >= 0) {
+            if (pread(fd, head, 2, 0) == 2 && head[0] == 0x1f && 
+                head[1] == 0x8b && st.st_size > 4 &&
+                pread(fd, head, 4, st.st_size - 4) == 4) {
+                trot.seg[trot.segments].estimate = LE32(head) > st.st_size ? 
+                    (off_t)LE32(head) : st.st_size;
+            }
+            close(fd);
+        }
+
+        trot.estimate += trot.seg[trot.segments].estimate;
+        trot.segments++;
+    }
+
+    globfree(&found);
+
+    if (!trot.segments) {
+        errno = ENOENT;
+        my_perror(trot.pattern);
+    }
+
+    qsort(trot.seg, trot.segments, sizeof *trot.seg, rotated_order);
+
+    /* 'e' edits, and the status bar names, the newest one */
+    tfile.filename = trot.seg[trot.segments - 1].name;
+
+    trot.out = text_output();
+    trot.lazy = !topt.benchmark && !texport.active;
+    trot.active = TRUE;
+    tfile.growing = TRUE;
+
+    if (pthread_create(&trot.feeder, NULL, rotated_feeder, NULL) != 0) {
+        my_perror("pthread_create()");
+    }
+
+    pthread_detach(trot.feeder);
+
+    return 1;
+}
+
+/* higher rotation numbers are older; the live log has none */
+int rotated_order(const void *a, const void *b)
+{
+    const struct rot_segment *x = a, *y = b;
+
+    if (x->number != y->number) {
+        return x->number > y->number ? -1 : 1;
+    }
+
+    if (x->mtime != y->mtime) {
+        return x->mtime < y->mtime ? -1 : 1;
+    }
+
+    return strcmp(x->name, y->name);
+}
+
+/* Decode the segments into text_file in order, but only stay
+   ROTATE_AHEAD bytes in front of what's being shown, until an index
+   that needs the whole text turns trot.lazy off. */
+void *rotated_feeder(void *arg)
+{
+    gzFile gz;
+    char buf[BUFMAX];
+    size_t len = 0;
+    unsigned long int i;
+
+    for (i = 0; i < trot.segments; i++) {
+        trot.seg[i].start = trot.written;
+        trot.opened = i + 1;
+
+        if (!(gz = gzopen(trot.seg[i].name, "rb"))) {
+            continue; /* rotated away since we looked */
+        }
+
+        gzbuffer(gz, PIPE_CHUNK);
+
+        while (gzgets(gz, buf, sizeof buf)) {
+            while (trot.lazy && trot.written - trot.shown > ROTATE_AHEAD) {
+                fflush(trot.out);
+                napms(50);
+            }
+
+            if (!topt.view_normal && squeeze_blank(buf, &trot.blank)) {
+                continue;
+            }
+
+            len = strlen(buf);
+            fputs(buf, trot.out);
+            trot.written += len;
+        }
+
+        /* don't let a segment's last line run into the next one's first */
+        if (len && buf[len - 1] != '\n') {
+            fputc('\n', trot.out);
+            trot.written++;
+        }
+
+        gzclose(gz);
+        fflush(trot.out);
+    }
+
+    fclose(trot.out);
+    tfile.growing = FALSE;
+
+    return NULL;
+}
+
+/* which segment the text at offset came from */
+unsigned long int rotated_segment_at(off_t offset)
+{
+    unsigned long int lo = 0, hi = trot.opened, mid;
+
+    while (lo + 1 < hi) {
+        mid = (lo + hi) / 2;
+
+        if (trot.seg[mid].start <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/* Start lesspipe and fmt on the file, the same pipeline for scrolling
+   and --export. The text is read as it comes out. */
+int text_stream(void)
+{
+    ttext.out = text_output();
+    tfile.growing = TRUE;
+
+    if (pthread_create(&ttext.feeder, NULL, text_feeder, NULL) != 0) {
+        my_perror("pthread_create()");
+    }
+
+    pthread_detach(ttext.feeder);
+
+    return 1;
+}
+
+/* lesspipe() and fmt() as one pipeline instead of through text_file */
+void *text_feeder(void *arg)
+{
+    FILE *fp;
+    char *c, *lesspipe, command[BUFMAX * 3], lesscommand[BUFMAX];
+    char qfilename[BUFMAX];
+    unsigned long long n = 0;
+
+    shell_quote(qfilename, sizeof qfilename, tfile.filename);
+    lesspipe = getenv("LESSOPEN");
+
+    if (lesspipe && (c = strchr(lesspipe, '|'))) {
+        snprintf(lesscommand, sizeof lesscommand, "%s%s%s", c + 1,
+            check_if_pdf(tfile.filename) ? " -" : "", 
+            thscroll.active ? "" : " | fmt -s");
+        snprintf(command, sizeof command, lesscommand, qfilename);
+
+        if ((fp = popen(command, "r"))) {
+            n = text_copy(fp);
+            pclose(fp);
+        }
+    }
+
+    if (!n) { /* lesspipe had nothing to say, use the file as it is */
+        snprintf(command, sizeof command, "%s %s", 
+            thscroll.active ? "cat" : "fmt -s", qfilename);
+
+        if (!(fp = popen(command, "r"))) {
+            my_perror("popen()");
+        }
+
+        text_copy(fp);
+        pclose(fp);
+    }
+
+    fclose(ttext.out);
+    tfile.growing = FALSE;
+
+    return NULL;
+}
+
+/* Copy fp into the text, leaving out blank runs, and let the reader
+   have it every PIPE_CHUNK. Returns the bytes read. */
+unsigned long long text_copy(FILE *fp)
+{
+    char buf[BUFMAX];
+    unsigned long long n = 0, flushed = 0;
+
+    while (fgets(buf, sizeof buf, fp)) {
+        n += strlen(buf);
+
+        if (!topt.view_normal && squeeze_blank(buf, &ttext.blank)) {
+            continue;
+        }
+
+        fputs(buf, ttext.out);
+
+        if (n - flushed >= PIPE_CHUNK) {
+            fflush(ttext.out);
+            flushed = n;
+        }
+    }
+
+    fflush(ttext.out);
+
+    return n;
+}
+
+/* Where the decoders write their text */
+FILE *text_output(void)
+{
+    FILE *fp;
+
+    if (texport.active) {
+        fp = fdopen(texport.fd[1], "w");
+    } else {
+        printf("Loading...\n");
+        fp = fopen(tfile.text_file, "w");
+    }
+
+    if (!fp) {
+        my_perror("fopen()");
+    }
+
+    return fp;
+}
+
+/* Copy lines to stdout the way they'd be scrolled, squeezing blank
+   runs if the source hasn't already. Returns the bytes read. */
+unsigned long long export_copy(FILE *fp, unsigned int squeeze)
+{
+    char buf[BUFMAX], rbuf[BUFMAX];
+    unsigned long long n = 0;
+    unsigned int blank = 0;
+
+    while (fgets(buf, sizeof buf, fp)) {
+        n += strlen(buf);
+
+        if (squeeze && !topt.view_normal && squeeze_blank(buf, &blank)) {
+            continue;
+        }
+
+        if (tcollapse.active && collapse_seen(buf)) {
+            continue;
+        }
+
+        if (tcollapse.repeats) {
+            collapse_note(rbuf, sizeof rbuf, FALSE);
+            fputs(rbuf, stdout);
+        }
+
+        if (topt.case_change) {
+            fold_case(rbuf, buf, topt.case_table);
+            fputs(rbuf, stdout);
+        } else {
+            fputs(buf, stdout);
+        }
+    }
+
+    if (tcollapse.repeats) { /* the input ended on a run */
+        collapse_note(rbuf, sizeof rbuf, FALSE);
+        fputs(rbuf, stdout);
+    }
+
+    return n;
+}
+
+void *export_reader(void *arg)
+{
+    FILE *fp;
+
+    if (!(fp = fdopen(texport.fd[0], "r"))) {
+        my_perror("fdopen()");
+    }
+
+    export_copy(fp, FALSE); /* the decoders squeeze as they go */
+    fclose(fp);
+
+    return NULL;
+}
+
+/* --export: run the same preprocessing as scrolling does, but stream
+   the result to stdout, with no curses and nothing in ~/.textscroll */
+void export_text(void)
+{
+    setvbuf(stdout, NULL, _IOFBF, PIPE_CHUNK);
+
+    if (tfile.piped) { /* piped input is scrolled as it comes */
+        pipe_fmt();
+        export_copy(stdin, TRUE);
+        fflush(stdout);
+        return;
+    }
+
+    if (pipe(texport.fd) != 0) {
+        my_perror("pipe()");
+    }
+
+    /* so pdftotext and the rest don't hold the pipe open */
+    fcntl(texport.fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(texport.fd[1], F_SETFD, FD_CLOEXEC);
+
+    if (pthread_create(&texport.reader, NULL, export_reader, NULL) != 0) {
+        my_perror("pthread_create()");
+    }
+
+    if (trot.pattern) {
+        rotated_stream();
+    } else if ((!check_if_pdf(tfile.filename) || !pdf_stream()) &&
+               (!check_if_archive(tfile.filename) || !archive_stream())) {
+        text_stream();
+    }
+
+    pthread_join(texport.reader, NULL);
+    fflush(stdout);
+}
+
+/* word wrap text_file, to width columns or fmt's default if width is 0 */
+void fmt(char *text_file, char *text_tmp, int width)
+{
+    char command[BUFMAX * 3];
+
+    if (width) {
+        snprintf(command, sizeof command, "fmt -s -w %d %s > %s", width,
+            text_file, text_tmp);
+    } else {
+        snprintf(command, sizeof command, "fmt -s %s > %s", text_file, 
+            text_tmp);
+    }
+
+    system(command);
+
+    if (unlink(text_file)) {
+        my_perror("unlink()");
+    }
+
+    if (link(text_tmp, text_file) != 0) {
+        my_perror("link()");
+    }
+
+    if (unlink(text_tmp)) {
+        my_perror("unlink()");
+    }
+}
+
+/* Don't print 2+ blank lines: true if line should be left out */
+int squeeze_blank(char *line, unsigned int *blank)
+{
+    if (line[0] == CARRIAGE_RETURN || line[0] == LINEFEED) {
+        (*blank)++;
+    } else {
+        *blank = 0;
+    }
+
+    if (*blank == 2) {
+        *blank = 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Make it so you never have to stare at empty space */
+void strip_extra_blanks(char *text_file, char *text_tmp)
+{
+    FILE *fp_read, *fp_write;
+    char buf[BUFMAX];
+    unsigned int blank = 0;
+
+    if (!(fp_read = fopen(text_file, "r+"))) {
+        my_perror("fopen()");
+    }
+
+    if (!(fp_write = fopen(text_tmp, "w"))) {
+        my_perror("fopen()");
+    }
+
+    while (fgets(buf, sizeof buf, fp_read)) {
+
+        if (squeeze_blank(buf, &blank)) {
+            continue;
+        }
+
+        fprintf(fp_write, "%s", buf);
+    }
+
+    fclose(fp_read);
+    fclose(fp_write);
+
+    if (unlink(text_file)) {
+        my_perror("unlink()");
+    }
+
+    if (link(text_tmp, text_file) != 0) {
+        my_perror("link()");
+    }
+
+    if (unlink(text_tmp)) {
+        my_perror("unlink()");
+    }
+}
+
+void scroll_it(unsigned int scroll_speed, int argc, char *filename_nodashf, 
+               char *progname)
+{
+    struct scroll_state st;
+    char *path;
+
+    memset(&st, 0, sizeof st);
+    st.scroll_speed = st.origspeed = scroll_speed;
+    st.toggle = ON;
+    st.attr = A_NORMAL;
+    st.input = user_input;
+
+    topt.y = LINES - 2;
+
+    if (topt.pos_changed) {
+        topt.y = topt.pos_changed;
+    }
+
+    if ((topt.y > LINES - 2) || (topt.y < 1)) {
+        usage(progname);
+    }
+
+    if (!tfile.piped)  { /* if they used -f */
+
+        path = tskim.active ? tfile.filename : tfile.text_file;
+
+        if (wr_open(&twin, path) < 0) {
+            cperror(path);
+        }
+
+        tfile.the_file_size = twin.size;
+
+        /* a decoder still writing the text may not have got there yet */
+        if (tresume.line && !tfile.growing) {
+            wr_seek(&twin, tresume.offset);
+            st.line = tresume.line;
+            tcount.lines = tresume.total; /* until it's been counted */
+            tfile.page_num = tresume.line / LINES + 1;
+
+            if (!tresume.speed_given && tresume.speed) {
+                st.scroll_speed = st.origspeed = tresume.speed;
+            }
+        }
+
+        if (tresume.path[0]) {
+            tresume.st = &st;
+        }
+
+        if (tskim.active) { /* counting, or indexing, reads it all */
+            skim_setup();
+        } else {
+            start_line_count();
+
+            if (tahead.size) {
+                start_readahead();
+            }
+
+            if (trsvp.active) {
+                start_rsvp_index();
+            } else if (topt.word_given) { /* matches are found by line */
+                start_match_index();
+            }
+        }
+
+    } else { 
+        tfile.display_filename = "piped output";
+    }
+
+    if (thscroll.active) {
+        hscroll_setup();
+    }
+
+    if (tctl.path) {
+        tctl.st = &st;
+        control_setup();
+    }
+
+    build_pipeline(&st);
+    output_setup();
+
+    if (trsvp.active) {
+        rsvp_scroll(&st);
+    } else if (topt.scrollmode_chars && !trep.active && !thscroll.active) {
+        /* replay and --nowrap go by lines */
+        char_scroll(&st);
+    } else {
+        line_scroll(&st);
+    }
+
+    if (tresume.st) { /* read to the end, nothing to come back to */
+        resume_forget();
+        tresume.st = NULL;
+    }
+
+    get_stats(st.total_lines, st.line); /* see stats at eof */
+    mirror_frame();
+    wait_key(pscroll->scrollwin);
+
+    if (!tfile.piped) {
+        wr_close(&twin);
+    }
+}
+
+/* Pick the stages this run needs. Called again when the status bar is
+   switched on or off. */
+void build_pipeline(struct scroll_state *st)
+{
+    tpipeline.count = 0;
+
+    if (thscroll.active) { /* first, so the rest see the whole line */
+        tpipeline.stage[tpipeline.count++] = stage_nowrap;
+    }
+
+    if (tskim.active) {
+        tpipeline.stage[tpipeline.count++] = stage_skim;
+    }
+
+    if (topt.colorize) {
+        tpipeline.stage[tpipeline.count++] = stage_colorize;
+    }
+
+    if (trep.active) {
+        tpipeline.stage[tpipeline.count++] = stage_replay;
+    }
+
+    if (tmatch.running) {
+        tpipeline.stage[tpipeline.count++] = stage_match_cursor;
+    }
+
+    /* --nowrap changes the case of just the columns it draws */
+    if (topt.case_change && !thscroll.active) {
+        tpipeline.stage[tpipeline.count++] = stage_case;
+    }
+
+    /* With -u/-l the drawn copy is already folded, so -i searches that
+       instead of folding the line a second time. Case sensitive matching
+       always looks at the line as it is in the file. */
+    if (thscroll.active) {
+        /* stage_nowrap matches -w against the whole line */
+    } else if (topt.word_given && !topt.ignore_case) {
+        tpipeline.stage[tpipeline.count++] = stage_highlight;
+    } else if (topt.word_given && topt.case_change) {
+        tpipeline.stage[tpipeline.count++] = stage_highlight_folded;
+    } else if (topt.word_given) {
+        tpipeline.stage[tpipeline.count++] = stage_highlight_nocase;
+    }
+
+    if (!topt.statusbar || !st->toggle) {
+        st->status = status_none;
+    } else if (topt.bandwidth) {
+        st->status = status_throttled;
+    } else {
+        st->status = status_every;
+    }
+
+    if (thscroll.active) {
+        st->draw = draw_line_nowrap;
+    } else if (topt.colorize) {
+        st->draw = draw_line_color;
+    } else if (topt.bandwidth && topt.statusbar) {
+        st->draw = draw_line_bottom;
+    } else {
+        st->draw = draw_line;
+    }
+
+    st->wait = trep.active ? wait_replay : wait_fixed;
+}
+
+void run_pipeline(char *buf, struct scroll_state *st)
+{
+    unsigned int i;
+
+    st->out = buf;
+
+    for (i = 0; i < tpipeline.count; i++) {
+        tpipeline.stage[i](buf, st);
+    }
+}
+
+void stage_match_cursor(char *buf, struct scroll_state *st)
+{
+    match_advance(st->line);
+}
+
+void stage_highlight(char *buf, struct scroll_state *st)
+{
+    /* highlight the entire line special_word is on */
+    st->matched = word_match(buf, topt.special_word, topt.folded_word);
+    st->attr = st->matched ? A_BOLD : A_NORMAL;
+}
+
+void stage_highlight_nocase(char *buf, struct scroll_state *st)
+{
+    fold_case(st->fold, buf, lower_table);
+    st->matched = strstr(st->fold, topt.folded_word) != NULL;
+    st->attr = st->matched ? A_BOLD : A_NORMAL;
+}
+
+void stage_highlight_folded(char *buf, struct scroll_state *st)
+{
+    st->matched = strstr(st->out, topt.drawn_word) != NULL;
+    st->attr = st->matched ? A_BOLD : A_NORMAL;
+}
+
+/* -u/-l: draw a converted copy and leave the line itself alone */
+void stage_case(char *buf, struct scroll_state *st)
+{
+    fold_case(st->rbuf, buf, topt.case_table);
+    st->out = st->rbuf;
+}
+
+void status_every(struct scroll_state *st)
+{
+    get_stats(st->total_lines, st->line);
+}
+
+void status_throttled(struct scroll_state *st)
+{
+    if (status_due()) {
+        get_stats(st->total_lines, st->line);
+    }
+}
+
+void status_none(struct scroll_state *st)
+{
+}
+
+void draw_line(char *buf, struct scroll_state *st)
+{
+    mvwprintw(pscroll->scrollwin, topt.y, 0, "%s", buf);
+}
+
+/* topt.y is the window's last row with --bandwidth, so a trailing
+   newline would scroll it a second time */
+void draw_line_bottom(char *buf, struct scroll_state *st)
+{
+    mvwaddnstr(pscroll->scrollwin, topt.y, 0, buf, strcspn(buf, "\r\n"));
+}
+
+/* --nowrap: a slot for every row of the scroll window */
+void hscroll_setup(void)
+{
+    thscroll.rows = getmaxy(pscroll->scrollwin);
+
+    if (!(thscroll.line = (char **)calloc(thscroll.rows, sizeof(char *))) ||
+        !(thscroll.len = (size_t *)calloc(thscroll.rows, sizeof(size_t))) ||
+        !(thscroll.alloced = (size_t *)calloc(thscroll.rows, 
+                                              sizeof(size_t))) ||
+        !(thscroll.attr = (attr_t *)calloc(thscroll.rows, sizeof(attr_t))) ||
+        !(thscroll.colors = (struct color_spans *)calloc(thscroll.rows,
+                                            sizeof(struct color_spans)))) {
+        cperror("calloc()");
+    }
+}
+
+/* Join the rest of a long line on to the piece in buf and keep it for
+   the row it's drawn on. -w is matched against the whole line. */
+void stage_nowrap(char *buf, struct scroll_state *st)
+{
+    unsigned int slot = (thscroll.top + topt.y) % thscroll.rows;
+    char piece[BUFMAX], *p = buf;
+    size_t len = 0, n = strlen(buf);
+
+    for (;;) {
+        if (len + n + 1 > thscroll.alloced[slot]) {
+            thscroll.alloced[slot] = (len + n + 1) * 2;
+
+            if (!(thscroll.line[slot] = (char *)realloc(thscroll.line[slot],
+                                                  thscroll.alloced[slot]))) {
+                cperror("realloc()");
+            }
+        }
+
+        memcpy(thscroll.line[slot] + len, p, n + 1);
+        len += n;
+
+        /* the pieces after the first count as lines, as they do for
+           the line count and the match index */
+        if (!n || p[n - 1] == '\n' || !next_line(piece, sizeof piece, st)) {
+            break;
+        }
+
+        st->line++;
+        p = piece;
+        n = strlen(piece);
+    }
+
+    thscroll.len[slot] = len;
+
+    if (topt.word_given && !topt.ignore_case) {
+        st->matched = strstr(thscroll.line[slot], topt.special_word) != NULL;
+    } else if (topt.word_given) {
+        if (len + 1 > thscroll.fold_alloced) {
+            thscroll.fold_alloced = thscroll.alloced[slot];
+
+            if (!(thscroll.fold = (char *)realloc(thscroll.fold, 
+                                                  thscroll.fold_alloced))) {
+                cperror("realloc()");
+            }
+        }
+
+        fold_case(thscroll.fold, thscroll.line[slot], lower_table);
+        st->matched = strstr(thscroll.fold, topt.folded_word) != NULL;
+    }
+
+    st->attr = st->matched ? A_BOLD : A_NORMAL;
+    thscroll.attr[slot] = st->attr;
+}
+
+void draw_line_nowrap(char *buf, struct scroll_state *st)
+{
+    hscroll_row(topt.y);
+}
+
+/* Draw the columns in view of the line kept for row. Tabs are expanded
+   and -u/-l applied here, so only what fits on screen is converted. */
+void hscroll_row(unsigned int row)
+{
+    WINDOW *win = pscroll->scrollwin;
+    unsigned int slot = (thscroll.top + row) % thscroll.rows;
+    struct color_span *sp = thscroll.colors[slot].span;
+    struct color_span *last = sp + thscroll.colors[slot].count;
+    chtype out[BUFMAX], attr = thscroll.attr[slot], ch;
+    char *c = thscroll.line[slot], *end;
+    unsigned long int col = 0;
+    size_t pos;
+    int width = getmaxx(win), n = 0;
+
+    if ((int)row == getmaxy(win) - 1) {
+        width--; /* the last column there would scroll the window */
+    }
+
+    if (width > BUFMAX) {
+        width = BUFMAX;
+    }
+
+    wmove(win, row, 0);
+    wclrtoeol(win);
+
+    if (!c) {
+        return;
+    }
+
+    end = c + thscroll.len[slot];
+
+    for (; c < end && col < thscroll.col && *c != '\n' && *c != '\r'; c++) {
+        col = *c == '\t' ? (col | 7) + 1 : col + 1;
+    }
+
+    for (; col > thscroll.col && n < width; col--) {
+        out[n++] = ' ' | attr; /* a tab across the left edge */
+    }
+
+    for (; c < end && n < width && *c != '\n' && *c != '\r'; c++) {
+        pos = c - thscroll.line[slot];
+
+        while (sp < last && sp->start + sp->len <= pos) {
+            sp++; /* --colorize spans that end before c */
+        }
+
+        ch = topt.case_change ? topt.case_table[(unsigned char)*c]
+                              : (unsigned char)*c;
+
+        if (sp < last && sp->start <= pos) {
+            ch |= sp->attr;
+        }
+
+        if (*c == '\t') {
+            do {
+                out[n++] = ' ' | attr;
+            } while (n < width && (thscroll.col + n) % 8);
+        } else {
+            out[n++] = ch | attr;
+        }
+    }
+
+    mvwaddchnstr(win, row, 0, out, n);
+}
+
+/* the window scrolled up a row: row 0's slot comes back at the bottom */
+void hscroll_scrolled(void)
+{
+    unsigned int slot = thscroll.top;
+
+    thscroll.top = (thscroll.top + 1) % thscroll.rows;
+    thscroll.len[slot] = 0;
+    thscroll.attr[slot] = A_NORMAL;
+    thscroll.colors[slot].count = 0;
+}
+
+/* move the view delta columns right (or left), redrawing every row */
+void hscroll_pan(long delta)
+{
+    unsigned int row;
+
+    if (!thscroll.active) {
+        return;
+    }
+
+    if (delta < 0 && (unsigned long int)-delta > thscroll.col) {
+        thscroll.col = 0;
+    } else {
+        thscroll.col += delta;
+    }
+
+    for (row = 0; row <= topt.y && row < thscroll.rows; row++) {
+        hscroll_row(row);
+    }
+
+    wrefresh(pscroll->scrollwin);
+}
+
+/* --latency: run the rest of the way on a pty of our own, so no real
+   terminal is needed. This process only drains the screen output and
+   passes on the exit status. */
+void latency_pty(void)
+{
+    struct winsize ws = { 24, 80, 0, 0 };
+    char buf[PIPE_CHUNK];
+    int master, slave, status;
+    ssize_t n;
+    pid_t pid;
+
+    if ((master = posix_openpt(O_RDWR|O_NOCTTY)) < 0 || grantpt(master) ||
+        unlockpt(master)) {
+        my_perror("posix_openpt()");
+    }
+
+    /* opened here, so the master never reads EIO before the child's up */
+    if ((slave = open(ptsname(master), O_RDWR|O_NOCTTY)) < 0) {
+        my_perror(ptsname(master));
+    }
+
+    ioctl(slave, TIOCSWINSZ, &ws); /* later would be a SIGWINCH */
+
+    if (!(tlat.report = fdopen(dup(STDOUT_FILENO), "w"))) {
+        my_perror("fdopen()");
+    }
+
+    if ((pid = fork()) < 0) {
+        my_perror("fork()");
+    }
+
+    if (pid == 0) {
+        setsid();
+        ioctl(slave, TIOCSCTTY, 0);
+        close(master);
+
+        /* stderr stays where it was, so errors are still seen */
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        close(slave);
+        setenv("TERM", "xterm", 0);
+
+        return;
+    }
+
+    fclose(tlat.report);
+    close(slave);
+
+    while ((n = read(master, buf, sizeof buf)) > 0 || 
+           (n < 0 && errno == EINTR))
+        ;
+
+    waitpid(pid, &status, 0);
+    exit(WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
+}
+
+/* read the next "<ms> <key>" line of the script */
+void latency_next(void)
+{
+    char buf[BUFMAX], name[BUFMAX];
+    double ms;
+
+    tlat.key = ERR;
+
+    while (fgets(buf, sizeof buf, tlat.script)) {
+        if (buf[0] == '#' || sscanf(buf, "%lf %s", &ms, name) != 2) {
+            continue;
+        }
+
+        tlat.key_at = tlat.start + ms / 1000;
+
+        if (!strcmp(name, "space")) {
+            tlat.key = ' ';
+        } else if (!strcmp(name, "left")) {
+            tlat.key = KEY_LEFT;
+        } else if (!strcmp(name, "right")) {
+            tlat.key = KEY_RIGHT;
+        } else if (!strcmp(name, "home")) {
+            tlat.key = KEY_HOME;
+        } else {
+            tlat.key = (unsigned char)name[0];
+        }
+
+        return;
+    }
+}
+
+/* the scripted key that's been pressed by now, if any */
+int latency_key(void)
+{
+    int key = tlat.key;
+
+    if (key == ERR || mono_now() < tlat.key_at) {
+        return ERR;
+    }
+
+    tlat.pressed = mono_now() - tlat.skipped;
+    latency_next();
+
+    return key;
+}
+
+/* Waiting for a key: jump the clock to the next one in the script, or
+   quit once the script has run out */
+int latency_wait(void)
+{
+    double now = mono_now();
+
+    latency_seen(); /* pausing, or the 'i' screen, is the response */
+    tlat.due = 0;
+
+    if (tlat.key == ERR) {
+        return 'q';
+    }
+
+    if (tlat.key_at > now) {
+        tlat.skipped += tlat.key_at - now;
+    }
+
+    return latency_key();
+}
+
+/* put a time in ms into its power of two bucket */
+void latency_count(unsigned long int *hist, double secs)
+{
+    unsigned int i = 0;
+    double ms = secs * 1000;
+
+    while (ms >= 1 && i < LATENCY_BUCKETS - 1) {
+        ms /= 2;
+        i++;
+    }
+
+    hist[i]++;
+}
+
+/* A key that's been acted on has reached the screen. Only the work
+   counts: the sleep until the next line is due isn't part of it. */
+void latency_seen(void)
+{
+    double took;
+
+    if (!tlat.pressed) {
+        return;
+    }
+
+    took = mono_now() - tlat.skipped - tlat.pressed;
+    tlat.pressed = 0;
+
+    if (tlat.count == tlat.alloced) {
+        tlat.alloced = tlat.alloced ? tlat.alloced * 2 : 64;
+
+        if (!(tlat.took = (double *)realloc(tlat.took, 
+                                            tlat.alloced * sizeof(double)))) {
+            cperror("realloc()");
+        }
+    }
+
+    tlat.took[tlat.count++] = took;
+    latency_count(tlat.keys, took);
+
+    if (took > tlat.key_max) {
+        tlat.key_max = took;
+    }
+}
+
+/* a frame has gone out: how late was it, and was a key waiting on it */
+void latency_frame(void)
+{
+    double late;
+
+    latency_seen();
+
+    if (tlat.due) {
+        late = mono_now() - tlat.due;
+        latency_count(tlat.frames, late > 0 ? late : 0);
+        tlat.frame_count++;
+
+        if (late > tlat.frame_max) {
+            tlat.frame_max = late;
+        }
+
+        tlat.due = 0;
+    }
+}
+
+int latency_order(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Print the histograms. The exit status is 1 if the 99th percentile
+   keypress took longer than --latency-max. */
+int latency_report(void)
+{
+    double p50 = 0, p99 = 0;
+    unsigned int i;
+
+    if (!tlat.active) {
+        return EXIT_SUCCESS;
+    }
+
+    latency_seen();
+
+    if (tlat.count) {
+        qsort(tlat.took, tlat.count, sizeof(double), latency_order);
+        p50 = tlat.took[(tlat.count - 1) / 2];
+        p99 = tlat.took[(tlat.count * 99 - 1) / 100];
+    }
+
+    fprintf(tlat.report, "keypress to screen: %lu keys, p50 %.1fms, "
+        "p99 %.1fms, max %.1fms\n", tlat.count, p50 * 1000, p99 * 1000, 
+        tlat.key_max * 1000);
+    fprintf(tlat.report, "frame lateness: %lu frames, max %.1fms\n\n",
+        tlat.frame_count, tlat.frame_max * 1000);
+    fprintf(tlat.report, "%14s %8s %8s\n", "ms", "keys", "frames");
+
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        if (!i) {
+            fprintf(tlat.report, "%14s", "< 1");
+        } else if (i == LATENCY_BUCKETS - 1) {
+            fprintf(tlat.report, "%8s %5lu", ">=", 1UL << (i - 1));
+        } else {
+            fprintf(tlat.report, "%8lu-%5lu", 1UL << (i - 1), 1UL << i);
+        }
+
+        fprintf(tlat.report, " %8lu %8lu\n", tlat.keys[i], tlat.frames[i]);
+    }
+
+    if (tlat.max && p99 * 1000 > tlat.max) {
+        fprintf(tlat.report, "\np99 keypress latency %.1fms is over %.1fms\n",
+            p99 * 1000, tlat.max);
+        fclose(tlat.report);
+        return EXIT_FAILURE;
+    }
+
+    fclose(tlat.report);
+
+    return EXIT_SUCCESS;
+}
+
+/* sleep, or with --latency just move the clock on */
+void nap(unsigned int ms)
+{
+    if (!tlat.active) {
+        napms(ms);
+        return;
+    }
+
+    tlat.due = mono_now() + ms / 1000.0;
+    tlat.skipped += ms / 1000.0;
+}
+
+/* block until a key is pressed */
+int wait_key(WINDOW *win)
+{
+    int key;
+
+    if (tlat.active) {
+        return latency_wait();
+    }
+
+    if (tctl.fd < 0) {
+        nodelay(win, FALSE);
+        return wgetch(win);
+    }
+
+    /* a paused scroll still takes commands, and "resume" ends the wait */
+    tctl.waiting = TRUE;
+
+    for (tctl.wake = FALSE; !tctl.wake; ) {
+        wtimeout(win, 50);
+
+        if ((key = wgetch(win)) != ERR) {
+            break;
+        }
+
+        control_poll();
+    }
+
+    tctl.waiting = tctl.wake = FALSE;
+
+    return key;
+}
+
+/* --skim-lines/--skim-bytes: work out how far apart the samples are
+   from the average line length near the start of the file */
+void skim_setup(void)
+{
+    off_t len = twin.size < SKIM_PROBE ? twin.size : SKIM_PROBE;
+    unsigned long int lines = 0;
+    char *p, *c, *end;
+
+    if (len && (p = wr_peek(&twin, 0, len))) {
+        for (c = p, end = p + len; (c = memchr(c, '\n', end - c)); c++) {
+            lines++;
+        }
+    }
+
+    wr_seek(&twin, 0);
+    wr_sample(&twin); /* the probe was read through, the rest isn't */
+    tskim.line_len = lines ? (double)len / lines : (double)len + 1;
+
+    if (!tskim.stride) {
+        tskim.stride = (off_t)(tskim.lines * tskim.line_len);
+    }
+
+    if (tskim.stride < 1) {
+        tskim.stride = 1;
+    }
+
+    /* nothing counts the lines, so the total is a guess too */
+    tcount.lines = (unsigned long int)(twin.size / tskim.line_len);
+}
+
+/* Seek straight to the next sample point and skip to the start of the
+   next line there, rather than reading everything in between */
+void stage_skim(char *buf, struct scroll_state *st)
+{
+    char rest[BUFMAX];
+    off_t next = ++tskim.samples * tskim.stride;
+    size_t len;
+
+    st->line = (unsigned long int)(tskim.at / tskim.line_len) + 1;
+
+    if (next >= twin.size) {
+        wr_seek(&twin, twin.size);
+    } else if (next > twin.pos) {
+        wr_seek(&twin, next - 1); /* a line starting at next is kept */
+
+        while (wr_gets(&twin, rest, sizeof rest) && 
+               (len = strlen(rest)) && rest[len - 1] != '\n')
+            ;
+    }
+
+    tskim.at = twin.pos;
+}
+
+/* --replay: work out when this line should appear from its timestamp */
+void stage_replay(char *buf, struct scroll_state *st)
+{
+    double stamp, gap;
+
+    trep.speed = trep.mult * st->origspeed / st->scroll_speed;
+
+    if (!parse_stamp(buf, &stamp)) {
+        return; /* continuation lines go out with the line before */
+    }
+
+    gap = trep.have_last ? stamp - trep.last : 0;
+    trep.last = stamp;
+    trep.have_last = TRUE;
+
+    if (gap < 0) {
+        gap = 0; /* out of order, or syslog going from Dec to Jan */
+    }
+
+    if (trep.max_gap && gap > trep.max_gap) {
+        gap = trep.max_gap;
+    }
+
+    trep.due += gap / trep.speed;
+}
+
+/* Sleep until the line is due. The deadline is absolute on the
+   monotonic clock, so time spent drawing doesn't add up over a run. */
+void wait_replay(struct scroll_state *st)
+{
+    if (mono_now() - trep.due > 1.0) {
+        trep.due = mono_now(); /* after a pause, or if the terminal fell behind */
+    }
+
+    if (!sleep_until(trep.due, st)) {
+        trep.due = mono_now(); /* sped up or slowed down: go from here */
+    }
+}
+
+/* clock_nanosleep() to a CLOCK_MONOTONIC deadline, waking now and then
+   so keys still work during long waits. Returns 0 if the speed was
+   changed meanwhile and the deadline no longer means anything. */
+int sleep_until(double due, struct scroll_state *st)
+{
+    struct timespec until;
+    unsigned int speed = st->scroll_speed;
+    double now = mono_now(), step;
+
+    if (tlat.active) {
+        tlat.due = due;
+    }
+
+    while (due > now) {
+        step = due - now > 0.05 ? now + 0.05 : due;
+        until.tv_sec = (time_t)(step - tlat.skipped);
+        until.tv_nsec = (long)((step - tlat.skipped - until.tv_sec) * 1e9);
+
+        if (tlat.active) {
+            tlat.skipped += step - now;
+        } else {
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, 
+                   NULL) == EINTR)
+                ;
+        }
+
+        if (step < due) {
+            st->input(st);
+
+            if (st->scroll_speed != speed) {
+                return 0;
+            }
+        }
+
+        now = mono_now();
+    }
+
+    return 1;
+}
+
+void wait_fixed(struct scroll_state *st)
+{
+    nap(st->scroll_speed);
+}
+
+double mono_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9 + tlat.skipped;
+}
+
+/* isdigit() is a function call into the locale tables; this runs on
+   every character of every timestamp */
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+#define IS_SPACE(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+#define IS_ALPHA(c) (((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'z')
+#define IS_ALNUM(c) (IS_DIGIT(c) || IS_ALPHA(c))
+#define IS_XDIGIT(c) (IS_DIGIT(c) || \
+                      (((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'f'))
+
+/* --colorize: a colour pair for each kind of token */
+void colorize_setup(void)
+{
+    if (has_colors() == FALSE) {
+        cperror("Your terminal does not support colors");
+    }
+
+    start_color();
+
+    if (!topt.want_color) {
+        use_default_colors(); /* -1 below is the terminal's background */
+    }
+
+    init_pair(PAIR_ERROR, COLOR_RED, -1);
+    init_pair(PAIR_WARN, COLOR_YELLOW, -1);
+    init_pair(PAIR_INFO, COLOR_GREEN, -1);
+    init_pair(PAIR_DEBUG, COLOR_BLUE, -1);
+    init_pair(PAIR_TIME, COLOR_CYAN, -1);
+    init_pair(PAIR_HEX, COLOR_MAGENTA, -1);
+}
+
+void color_add(struct color_spans *cs, size_t start, size_t len, attr_t attr)
+{
+    if (cs->count == cs->alloced) {
+        cs->alloced = cs->alloced ? cs->alloced * 2 : 16;
+
+        if (!(cs->span = (struct color_span *)realloc(cs->span, 
+                              cs->alloced * sizeof(struct color_span)))) {
+            cperror("realloc()");
+        }
+    }
+
+    cs->span[cs->count].start = start;
+    cs->span[cs->count].len = len;
+    cs->span[cs->count].attr = attr;
+    cs->count++;
+}
+
+/* the severity a word like ERROR or warn stands for, if any */
+attr_t color_level(unsigned char *w, size_t len)
+{
+    static struct {
+        char *word;
+        attr_t attr;
+    } level[] = {
+        { "error", COLOR_PAIR(PAIR_ERROR) | A_BOLD },
+        { "err", COLOR_PAIR(PAIR_ERROR) | A_BOLD },
+        { "fatal", COLOR_PAIR(PAIR_ERROR) | A_BOLD },
+        { "crit", COLOR_PAIR(PAIR_ERROR) | A_BOLD },
+        { "critical", COLOR_PAIR(PAIR_ERROR) | A_BOLD },
+        { "panic", COLOR_PAIR(PAIR_ERROR) | A_BOLD },
+        { "warn", COLOR_PAIR(PAIR_WARN) },
+        { "warning", COLOR_PAIR(PAIR_WARN) },
+        { "info", COLOR_PAIR(PAIR_INFO) },
+        { "notice", COLOR_PAIR(PAIR_INFO) },
+        { "debug", COLOR_PAIR(PAIR_DEBUG) },
+        { "trace", COLOR_PAIR(PAIR_DEBUG) },
+        { NULL, 0 }
+    };
+    unsigned int i;
+    size_t j;
+
+    if (len < 3 || len > 8) {
+        return 0;
+    }
+
+    for (i = 0; level[i].word; i++) {
+        for (j = 0; j < len && (w[j] | 0x20) == level[i].word[j]; j++)
+            ;
+
+        if (j == len && !level[i].word[j]) {
+            return level[i].attr;
+        }
+    }
+
+    return 0;
+}
+
+/* length of a 2024-01-31, 2024-01-31T12:00:00.123+01:00 or 12:00:00
+   style timestamp at s, or 0 */
+size_t color_stamp(unsigned char *s, unsigned char *end)
+{
+    unsigned char *p = s;
+
+    if (end - p >= 10 && IS_DIGIT(p[1]) && IS_DIGIT(p[2]) && IS_DIGIT(p[3]) &&
+        p[4] == '-' && IS_DIGIT(p[5]) && IS_DIGIT(p[6]) && p[7] == '-' && IS_DIGIT(p[8]) &&
+        IS_DIGIT(p[9])) {
+        p += 10;
+
+        if (end - p >= 9 && (*p == 'T' || *p == ' ') && IS_DIGIT(p[1])) {
+            p++;
+        } else {
+            return p - s;
+        }
+    }
+
+    if (end - p < 8 || !IS_DIGIT(p[1]) || p[2] != ':' || !IS_DIGIT(p[3]) ||
+        !IS_DIGIT(p[4]) || p[5] != ':' || !IS_DIGIT(p[6]) || 
+        !IS_DIGIT(p[7])) {
+        return p > s ? p - s - 1 : 0; /* a date followed by a space */
+    }
+
+    p += 8;
+
+    if (p + 1 < end && (*p == '.' || *p == ',') && IS_DIGIT(p[1])) {
+        for (p++; p < end && IS_DIGIT(*p); p++)
+            ;
+    }
+
+    if (p < end && *p == 'Z') {
+        p++;
+    } else if (end - p >= 5 && (*p == '+' || *p == '-') && IS_DIGIT(p[1]) &&
+               IS_DIGIT(p[2])) {
+        if (end - p >= 6 && p[3] == ':' && IS_DIGIT(p[4]) && IS_DIGIT(p[5])) {
+            p += 6; /* +01:00 */
+        } else if (IS_DIGIT(p[3]) && IS_DIGIT(p[4])) {
+            p += 5; /* +0100 */
+        }
+    }
+
+    return p - s;
+}
+
+/* One pass over the line noting where the severity words, timestamps
+   and hex ids are. Everything else is left alone. */
+void colorize_line(char *line, size_t len, struct color_spans *cs)
+{
+    unsigned char *s = (unsigned char *)line, *end = s + len, *start;
+    unsigned int digits, hex, others;
+    attr_t attr;
+    size_t n;
+
+    cs->count = 0;
+
+    while (s < end) {
+        if (!IS_ALNUM(*s)) {
+            s++;
+            continue;
+        }
+
+        start = s;
+
+        if (IS_DIGIT(*s) && (n = color_stamp(s, end))) {
+            color_add(cs, s - (unsigned char *)line, n, 
+                COLOR_PAIR(PAIR_TIME));
+            s += n;
+            continue;
+        }
+
+        if (*s == '0' && s + 2 < end && (s[1] | 0x20) == 'x' && 
+            IS_XDIGIT(s[2])) {
+            for (s += 2; s < end && IS_XDIGIT(*s); s++)
+                ;
+
+            if (s == end || !IS_ALNUM(*s)) {
+                color_add(cs, start - (unsigned char *)line, s - start,
+                    COLOR_PAIR(PAIR_HEX));
+                continue;
+            }
+        }
+
+        for (digits = hex = others = 0; s < end && IS_ALNUM(*s); s++) {
+            if (IS_DIGIT(*s)) {
+                digits++;
+            } else if (IS_XDIGIT(*s)) {
+                hex++;
+            } else {
+                others++;
+            }
+        }
+
+        if (!digits) {
+            attr = color_level(start, s - start);
+        } else if (!others && hex && s - start >= 8) {
+            attr = COLOR_PAIR(PAIR_HEX); /* like a hash or an id */
+        } else {
+            attr = 0;
+        }
+
+        if (attr) {
+            color_add(cs, start - (unsigned char *)line, s - start, attr);
+        }
+    }
+}
+
+void stage_colorize(char *buf, struct scroll_state *st)
+{
+    unsigned int slot;
+
+    if (thscroll.active) { /* kept with the line, for panning */
+        slot = (thscroll.top + topt.y) % thscroll.rows;
+        colorize_line(thscroll.line[slot], thscroll.len[slot], 
+            &thscroll.colors[slot]);
+    } else {
+        colorize_line(buf, strlen(buf), &st->colors);
+    }
+}
+
+/* draw_line() and draw_line_bottom() with the colours put in */
+void draw_line_color(char *buf, struct scroll_state *st)
+{
+    WINDOW *win = pscroll->scrollwin;
+    struct color_span *sp = st->colors.span, *last = sp + st->colors.count;
+    size_t at = 0;
+
+    wmove(win, topt.y, 0);
+
+    for (; sp < last; sp++) {
+        waddnstr(win, buf + at, sp->start - at);
+        wattron(win, sp->attr);
+        waddnstr(win, buf + sp->start, sp->len);
+        wattroff(win, sp->attr);
+        wattron(win, st->attr); /* the -w bold may have gone with it */
+        at = sp->start + sp->len;
+    }
+
+    if (topt.bandwidth && topt.statusbar) {
+        waddnstr(win, buf + at, strcspn(buf + at, "\r\n"));
+    } else {
+        waddstr(win, buf + at);
+    }
+}
+
+/* --collapse: FNV-1a over the line. With --mask a run of digits counts
+   as one digit, so lines differing only in timestamps, counters or ids
+   hash the same. */
+unsigned long long collapse_hash(char *line)
+{
+    unsigned char *s = (unsigned char *)line;
+    unsigned long long h = 14695981039346656037ULL;
+
+    while (*s && *s != '\n' && *s != '\r') {
+        if (tcollapse.mask && IS_DIGIT(*s)) {
+            while (IS_DIGIT(*s)) {
+                s++;
+            }
+            h = (h ^ '0') * 1099511628211ULL;
+        } else {
+            h = (h ^ *s++) * 1099511628211ULL;
+        }
+    }
+
+    return h;
+}
+
+/* Is this line a repeat of one of the last --collapse lines? If not it
+   becomes one of them. Lines longer than BUFMAX come in pieces and are
+   always shown. */
+int collapse_seen(char *line)
+{
+    unsigned long long h;
+    unsigned int i, partial = tcollapse.partial;
+    size_t len = strlen(line);
+
+    tcollapse.partial = !len || line[len - 1] != '\n';
+
+    if (partial || tcollapse.partial) {
+        tcollapse.shown++;
+        return FALSE;
+    }
+
+    h = collapse_hash(line);
+
+    for (i = 0; i < tcollapse.filled; i++) {
+        if (tcollapse.hash[i] == h) {
+            tcollapse.repeats++;
+            tcollapse.suppressed++;
+            return TRUE;
+        }
+    }
+
+    tcollapse.hash[tcollapse.at] = h;
+    tcollapse.at = (tcollapse.at + 1) % tcollapse.window;
+
+    if (tcollapse.filled < tcollapse.window) {
+        tcollapse.filled++;
+    }
+
+    tcollapse.shown++;
+
+    return FALSE;
+}
+
+/* "[previous line repeated 4,812 times]" for the run that just ended,
+   or with "so far" for one that's still going */
+void collapse_note(char *buf, size_t size, unsigned int running)
+{
+    char digits[32], count[48];
+    int len = snprintf(digits, sizeof digits, "%lu", tcollapse.repeats);
+    int i, j = 0;
+
+    for (i = 0; i < len; i++) {
+        if (i && (len - i) % 3 == 0) {
+            count[j++] = ',';
+        }
+        count[j++] = digits[i];
+    }
+
+    count[j] = '\0';
+
+    if (tcollapse.window == 1) {
+        snprintf(buf, size, "[previous line repeated %s time%s%s]\n", count,
+            tcollapse.repeats == 1 ? "" : "s", running ? " so far" : "");
+    } else {
+        snprintf(buf, size, "[%s line%s repeating the previous %u%s]\n", 
+            count, tcollapse.repeats == 1 ? "" : "s", tcollapse.window,
+            running ? " so far" : "");
+    }
+
+    if (!running) {
+        tcollapse.repeats = 0;
+    }
+}
+
+/* next_line() with --collapse: repeats are read through as fast as they
+   come, without waiting out the scroll speed, and the run is shown as a
+   note ahead of the line that ended it. A run still going when the next
+   line is due gets a "so far" note instead, so a long one doesn't hold
+   up the keys and an endless one on a pipe still shows. */
+char *next_shown(char *buf, int size, struct scroll_state *st)
+{
+    double due = mono_now() + st->scroll_speed / 1000.0;
+
+    if (!tcollapse.active) {
+        return next_line(buf, size, st);
+    }
+
+    if (tcollapse.holding) {
+        tcollapse.holding = FALSE;
+        snprintf(buf, size, "%s", tcollapse.held);
+        return buf;
+    }
+
+    while (next_line(buf, size, st)) {
+        if (!collapse_seen(buf)) {
+            if (!tcollapse.repeats) {
+                return buf;
+            }
+
+            snprintf(tcollapse.held, sizeof tcollapse.held, "%s", buf);
+            tcollapse.holding = TRUE;
+            break;
+        }
+
+        st->line++; /* still a line of the file */
+
+        if (mono_now() >= due) {
+            collapse_note(buf, size, TRUE);
+            st->line--;
+            return buf;
+        }
+    }
+
+    if (!tcollapse.repeats) {
+        return NULL;
+    }
+
+    collapse_note(buf, size, FALSE);
+    st->line--; /* the note isn't */
+
+    return buf;
+}
+
+/* n digits at s as a number, or -1 */
+long read_digits(char *s, unsigned int n)
+{
+    long v = 0;
+
+    while (n--) {
+        if (!IS_DIGIT(*s)) {
+            return -1;
+        }
+        v = v * 10 + (*s++ - '0');
+    }
+
+    return v;
+}
+
+/* the .123 after the seconds, if there is one */
+double read_fraction(char *s)
+{
+    long v = 0;
+    double scale = 1;
+
+    if (*s != '.' && *s != ',') {
+        return 0;
+    }
+
+    for (s++; IS_DIGIT(*s) && scale < 1e9; s++, scale *= 10) {
+        v = v * 10 + (*s - '0');
+    }
+
+    return v / scale;
+}
+
+/* days since 1970-01-01 in the proleptic Gregorian calendar */
+long days_from_civil(long y, long m, long d)
+{
+    long era, yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+/* Read the timestamp a log line starts with, in seconds: ISO-8601
+   (2024-01-31T12:00:00.123), syslog (Jan 31 12:00:00), epoch seconds,
+   milliseconds or microseconds, or dmesg's [   12.345678]. Only the
+   gaps between lines matter, so time zones and syslog's missing year
+   are left alone. Done by hand since it runs on every line. */
+int parse_stamp(char *s, double *stamp)
+{
+    static char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    unsigned int bracket = 0, n;
+    long y, mo, d, h, mi, sec;
+    size_t len;
+    char *c;
+
+    if (*s == '[') {
+        bracket = 1;
+        for (s++, n = 0; *s == ' ' && n < 16; s++, n++)
+            ;
+    }
+
+    len = strnlen(s, 19); /* the fixed offsets below only go this far */
+
+    if (len == 19 && s[4] == '-' && s[7] == '-' && (s[10] == 'T' || s[10] == ' ') && 
+        s[13] == ':' && s[16] == ':') {
+        y = read_digits(s, 4);
+        mo = read_digits(s + 5, 2);
+        d = read_digits(s + 8, 2);
+        h = read_digits(s + 11, 2);
+        mi = read_digits(s + 14, 2);
+        sec = read_digits(s + 17, 2);
+
+        if (y < 0 || mo < 1 || mo > 12 || d < 1 || d > 31 || h < 0 || 
+            h > 23 || mi < 0 || mi > 59 || sec < 0 || sec > 60) {
+            return 0;
+        }
+
+        *stamp = days_from_civil(y, mo, d) * 86400.0 + h * 3600 + mi * 60 + 
+                 sec + read_fraction(s + 19);
+        return 1;
+    }
+
+    if (len >= 15 && s[0] >= 'A' && s[0] <= 'Z' && s[3] == ' ' && 
+        s[9] == ':' && s[12] == ':') {
+        for (mo = 0; mo < 12 && strncmp(s, months + mo * 3, 3); mo++)
+            ;
+        d = s[4] == ' ' ? read_digits(s + 5, 1) : read_digits(s + 4, 2);
+        h = read_digits(s + 7, 2);
+        mi = read_digits(s + 10, 2);
+        sec = read_digits(s + 13, 2);
+
+        if (mo == 12 || d < 1 || d > 31 || h < 0 || h > 23 || mi < 0 || 
+            mi > 59 || sec < 0 || sec > 60) {
+            return 0;
+        }
+
+        *stamp = days_from_civil(1970, mo + 1, d) * 86400.0 + h * 3600 + 
+                 mi * 60 + sec + read_fraction(s + 15);
+        return 1;
+    }
+
+    for (c = s, n = 0; IS_DIGIT(*c); c++, n++)
+        ;
+
+    if (bracket && n && *c == '.') {
+        *stamp = read_digits(s, n) + read_fraction(c);
+        return 1;
+    }
+
+    if (n == 10) {
+        *stamp = read_digits(s, 10) + read_fraction(c);
+        return 1;
+    }
+
+    if (n == 13 || n == 16) {
+        *stamp = read_digits(s, 10) + read_digits(s + 10, n - 10) / 
+                 (n == 13 ? 1e3 : 1e6);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* --rsvp: split the text into words ahead of the display, keeping just
+   where each starts and how long it is */
+void *rsvp_indexer(void *arg)
+{
+    struct window_reader wr;
+    char buf[BUFMAX];
+    unsigned int i, start;
+    off_t offset = 0;
+
+    if (wr_open(&wr, tfile.text_file) < 0) {
+        trsvp.done = TRUE;
+        return NULL;
+    }
+
+    for (;;) {
+        if (!wr_gets_whole(&wr, buf, sizeof buf)) {
+            if (wr_wait(&wr)) {
+                continue;
+            }
+
+            if (!wr_gets(&wr, buf, sizeof buf)) {
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&trsvp.lock);
+
+        for (i = 0; buf[i]; ) {
+            while (IS_SPACE(buf[i])) {
+                i++;
+            }
+
+            if (!buf[i]) {
+                break;
+            }
+
+            for (start = i; buf[i] && !IS_SPACE(buf[i]); i++)
+                ;
+
+            if (trsvp.count == trsvp.alloced) {
+                trsvp.alloced = trsvp.alloced ? trsvp.alloced * 2 : 4096;
+                trsvp.offset = (off_t *)realloc(trsvp.offset, 
+                    trsvp.alloced * sizeof(off_t));
+                trsvp.len = (unsigned char *)realloc(trsvp.len, 
+                    trsvp.alloced);
+                if (!trsvp.offset || !trsvp.len) {
+                    my_perror("realloc()");
+                }
+            }
+
+            trsvp.offset[trsvp.count] = offset + start;
+            trsvp.len[trsvp.count] = i - start > 255 ? 255 : i - start;
+            trsvp.count++;
+        }
+
+        pthread_mutex_unlock(&trsvp.lock);
+        offset = wr.pos;
+    }
+
+    wr_close(&wr);
+    pthread_mutex_lock(&trsvp.lock);
+    trsvp.done = TRUE;
+    pthread_mutex_unlock(&trsvp.lock);
+
+    return NULL;
+}
+
+void start_rsvp_index(void)
+{
+    trot.lazy = FALSE;
+
+    if (pthread_create(&trsvp.indexer, NULL, rsvp_indexer, NULL) != 0) {
+        cperror("pthread_create()");
+    }
+
+    pthread_detach(trsvp.indexer);
+}
+
+/* How long a word stays up, in ms at the --rsvp rate. Long words and
+   the ends of clauses and sentences get a little longer. */
+double rsvp_duration(char *word, unsigned int len)
+{
+    double ms = 60000.0 / trsvp.wpm;
+
+    if (len > 8) {
+        ms *= len > 18 ? 1.5 : 1 + (len - 8) * 0.05;
+    }
+
+    switch (word[len - 1]) {
+        case '.': case '!': case '?':
+            ms *= 2;
+            break;
+        case ',': case ';': case ':':
+            ms *= 1.5;
+            break;
+    }
+
+    return ms;
+}
+
+/* Put the next --words words into buf, waiting for the indexer if it
+   hasn't got that far. Returns how long to show them, 0 at the end. */
+double rsvp_frame(char *buf, int size, struct scroll_state *st)
+{
+    unsigned long int k = trsvp.current;
+    unsigned int n = 0, len, used = 0;
+    off_t offset;
+    double ms = 0;
+    char *word;
+
+    while (n < trsvp.words) {
+        pthread_mutex_lock(&trsvp.lock);
+
+        if (k + n >= trsvp.count) {
+            pthread_mutex_unlock(&trsvp.lock);
+
+            if (trsvp.done) {
+                break;
+            }
+
+            napms(20);
+            user_input(st);
+            continue;
+        }
+
+        offset = trsvp.offset[k + n];
+        len = trsvp.len[k + n];
+        pthread_mutex_unlock(&trsvp.lock);
+
+        if (used + len + 1 >= (unsigned int)size || 
+            !(word = wr_peek(&twin, offset, len))) {
+            break;
+        }
+
+        if (n) {
+            buf[used++] = ' ';
+        }
+
+        memcpy(buf + used, word, len);
+        used += len;
+        ms += rsvp_duration(word, len);
+        n++;
+    }
+
+    buf[used] = '\0';
+    trsvp.current = k + n;
+
+    return ms;
+}
+
+/* --rsvp: flash the text a word (or --words words) at a time in the
+   middle of the screen */
+void rsvp_scroll(struct scroll_state *st)
+{
+    char buf[BUFMAX];
+    int row = getmaxy(pscroll->scrollwin) / 2, len;
+    double ms, due = mono_now();
+
+    while ((ms = rsvp_frame(buf, sizeof buf, st)) > 0) {
+        st->line++;
+        run_pipeline(buf, st);
+        trsvp.speed = trsvp.wpm * st->origspeed / st->scroll_speed;
+        st->status(st);
+
+        len = strlen(st->out);
+        werase(pscroll->scrollwin);
+        wattrset(pscroll->scrollwin, st->attr);
+        mvwaddstr(pscroll->scrollwin, row, len < COLS ? (COLS - len) / 2 : 0,
+            st->out);
+        wrefresh(pscroll->scrollwin);
+        output_account(TRUE);
+        mirror_frame();
+
+        if (st->matched) {
+            highlight_word(st);
+        }
+
+        due += ms * st->scroll_speed / st->origspeed / 1000;
+        sleep_until(due, st);
+        user_input(st);
+
+        if (mono_now() - due > 1.0) {
+            due = mono_now(); /* after a pause */
+        }
+    }
+}
+
+/* --pane file[:speed[:word]]. The file may have colons in it too, so
+   the options are only split off the end, and only if they parse. */
+void pane_add(char *arg)
+{
+    struct pane *p;
+    char *c, *speed, *word = NULL;
+
+    if (tpanes.count == PANE_MAX) {
+        usage("textscroll");
+    }
+
+    p = &tpanes.pane[tpanes.count++];
+
+    if (!(p->filename = strdup(arg))) {
+        my_perror("strdup()");
+    }
+
+    if (access(p->filename, R_OK) != 0 && (c = strrchr(p->filename, ':'))) {
+        speed = c + 1;
+
+        if (!*speed || !char_check(speed)) { /* a word, the speed's before */
+            word = speed;
+            *c = '\0';
+            speed = (c = strrchr(p->filename, ':')) ? c + 1 : NULL;
+        }
+
+        if (speed && *speed && char_check(speed) && 
+            (p->speed = strtoul(speed, NULL, 10))) {
+            *c = '\0';
+            p->word = word && *word ? word : NULL;
+        } else {
+            strcpy(p->filename, arg); /* no options, just a missing file */
+            p->speed = 0;
+        }
+    }
+
+    if (access(p->filename, R_OK) != 0) {
+        my_perror(p->filename);
+    }
+}
+
+/* Load each pane's file the way a single file is, wrapped to the
+   pane's width, then tile them left to right with a line between. */
+void pane_setup(unsigned int scroll_speed)
+{
+    struct pane *p;
+    unsigned int i, width, rows;
+    char buf[BUFMAX], tmp[BUFMAX + 32];
+
+    if (tfile.filename && tpanes.count == PANE_MAX) {
+        usage("textscroll"); /* no room for -f */
+    }
+
+    if (tfile.filename) { /* -f goes first */
+        memmove(&tpanes.pane[1], &tpanes.pane[0], 
+            tpanes.count++ * sizeof(struct pane));
+        memset(&tpanes.pane[0], 0, sizeof(struct pane));
+        tpanes.pane[0].filename = tfile.filename;
     }
 
     create_windows();
-    
-    if (tfile.filename) {
-        tfile.display_filename = str_trunc(get_basename(tfile.filename), 15);
+    width = COLS / tpanes.count;
+    rows = topt.statusbar ? LINES - 1 : LINES;
+    snprintf(tmp, sizeof tmp, "%spane_tmp", tfile.homedir);
+
+    for (i = 0; i < tpanes.count; i++) {
+        p = &tpanes.pane[i];
+        snprintf(p->text_file, sizeof p->text_file, "%spane%u", 
+            tfile.homedir, i);
+
+        lesspipe(p->filename, p->text_file);
+        fmt(p->text_file, tmp, width > 3 ? width - 2 : 1);
+
+        if (!topt.view_normal) {
+            strip_extra_blanks(p->text_file, tmp);
+        }
+
+        if (wr_open(&p->wr, p->text_file) < 0) {
+            cperror(p->text_file);
+        }
+
+        while (wr_gets(&p->wr, buf, sizeof buf)) {
+            p->total++;
+        }
+
+        wr_seek(&p->wr, 0);
+
+        if (!p->speed) {
+            p->speed = scroll_speed;
+        }
+
+        if (!p->word && topt.word_given) {
+            p->word = topt.special_word;
+        } else if (p->word && topt.ignore_case) {
+            fold_case(p->word, p->word, lower_table);
+        }
+
+        if (p->word && topt.ignore_case && p->word == topt.special_word) {
+            p->word = topt.folded_word;
+        }
+
+        /* the last column of all but the last pane is the divider */
+        p->win = newwin(rows, width - 1, 0, i * width);
+        scrollok(p->win, TRUE);
+
+        if (topt.statusbar) {
+            p->statwin = newwin(1, width - 1, rows, i * width);
+            wbkgd(p->statwin, A_REVERSE);
+        }
+
+        if (i + 1 < tpanes.count) {
+            mvvline(0, (i + 1) * width - 1, ACS_VLINE, LINES);
+        }
     }
 
-    if (!topt.special_word) {
-        topt.special_word = "textscroll";
+    wnoutrefresh(stdscr);
+}
+
+void pane_status(struct pane *p)
+{
+    if (!p->statwin) {
+        return;
     }
 
-    if (scroll_speed) {
-         scroll_it(scroll_speed, argc, filename_nodashf, progname);
-    } else {
-        usage(progname);
+    werase(p->statwin);
+    mvwprintw(p->statwin, 0, 0, "%s %lu/%lu%s", 
+        str_trunc(get_basename(p->filename), 15), p->line, p->total,
+        p->done ? " - EOF" : "");
+    wnoutrefresh(p->statwin);
+}
+
+/* move one pane on a line; nothing reaches the terminal until the
+   frame's doupdate() */
+void pane_step(struct pane *p, struct scroll_state *st)
+{
+    char buf[BUFMAX];
+    size_t len;
+
+    if (!wr_gets(&p->wr, buf, sizeof buf)) {
+        p->done = TRUE;
+        pane_status(p);
+        return;
+    }
+
+    p->line++;
+    st->out = buf;
+    st->matched = FALSE;
+
+    if (p->word && topt.ignore_case) {
+        fold_case(st->fold, buf, lower_table);
+        st->matched = strstr(st->fold, p->word) != NULL;
+    } else if (p->word) {
+        st->matched = strstr(buf, p->word) != NULL;
+    }
+
+    if (topt.case_change) {
+        fold_case(st->rbuf, buf, topt.case_table);
+        st->out = st->rbuf;
+    }
+
+    scroll(p->win);
+    wattrset(p->win, st->matched ? A_BOLD : A_NORMAL);
+    /* short of the last column, which would scroll the pane again */
+    if ((len = strcspn(st->out, "\r\n")) >= (size_t)getmaxx(p->win)) {
+        len = getmaxx(p->win) - 1;
+    }
+
+    mvwaddnstr(p->win, getmaxy(p->win) - 1, 0, st->out, len);
+    wnoutrefresh(p->win);
+    pane_status(p);
+}
+
+/* One loop for every pane: sleep until the soonest one is due, move on
+   each pane that's due by then, and send the whole frame at once. */
+void pane_scroll(unsigned int scroll_speed)
+{
+    struct scroll_state st;
+    struct pane *p;
+    unsigned int i, active, matched;
+    double now, next = 0;
+
+    memset(&st, 0, sizeof st);
+    st.scroll_speed = st.origspeed = scroll_speed;
+    st.input = pane_input;
+
+    for (i = 0; i < tpanes.count; i++) {
+        tpanes.pane[i].due = mono_now() + tpanes.pane[i].speed / 1000.0;
+        pane_status(&tpanes.pane[i]);
+    }
+
+    doupdate();
+
+    for (;;) {
+        for (i = active = 0; i < tpanes.count; i++) {
+            p = &tpanes.pane[i];
+
+            if (!p->done && (!active++ || p->due < next)) {
+                next = p->due;
+            }
+        }
+
+        if (!active) {
+            break;
+        }
+
+        sleep_until(next, &st);
+        now = mono_now();
+        matched = FALSE;
+
+        for (i = 0; i < tpanes.count; i++) {
+            p = &tpanes.pane[i];
+
+            if (p->done || p->due > now) {
+                continue;
+            }
+
+            pane_step(p, &st);
+            matched |= st.matched;
+
+            /* 'f' and 's' scale every pane's speed alike */
+            p->due += (double)p->speed * st.scroll_speed / st.origspeed / 1000;
+
+            if (now - p->due > 1.0) {
+                p->due = now; /* after a pause */
+            }
+        }
+
+        doupdate();
+
+        if (tlat.active) {
+            latency_frame();
+        }
+
+        if (matched) {
+            highlight_word(&st);
+        }
+
+        pane_input(&st);
+    }
+
+    wait_key(stdscr);
+
+    for (i = 0; i < tpanes.count; i++) {
+        wr_close(&tpanes.pane[i].wr);
+    }
+}
+
+/* the keys that mean the same thing for all the panes at once */
+void pane_input(struct scroll_state *st)
+{
+    switch (get_key()) {
+        case 1:
+            st->scroll_speed = st->scroll_speed != 1 ? 1 : st->origspeed;
+            break;
+        case 2:
+            quit_cleanly();
+            break;
+        case 3:
+            st->scroll_speed = st->origspeed;
+            break;
+        case 4:
+            wait_key(stdscr);
+            break;
+        case 8:
+            st->scroll_speed -= ((st->scroll_speed * 25) / 100);
+            break;
+        case 9:
+            st->scroll_speed += ((st->scroll_speed * 25) / 100);
+            break;
+        case 10:
+            topt.auto_pause ^= 1;
+            break;
+    }
+}
+
+void pane_cleanup(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < tpanes.count; i++) {
+        if (*tpanes.pane[i].text_file) {
+            unlink(tpanes.pane[i].text_file);
+        }
+    }
+}
+
+void line_scroll(struct scroll_state *st)
+{
+    char buf[BUFMAX];
+
+    scrollok(pscroll->scrollwin, TRUE);
+
+    while (next_shown(buf, sizeof(buf), st)) { /* scroll time */
+        st->line++;
+        run_pipeline(buf, st);
+        st->status(st);
+
+        wattrset(pscroll->scrollwin, st->attr);
+        st->draw(st->out, st);
+        st->wait(st);
+        scroll(pscroll->scrollwin);
+
+        if (thscroll.active) {
+            hscroll_scrolled();
+        }
+
+        wrefresh(pscroll->scrollwin);
+        output_account(TRUE);
+        mirror_frame();
+
+        if (st->matched) {
+            highlight_word(st);
+        }
+
+        user_input(st);
+        match_jump(&st->line);
+    }
+}
+
+void char_scroll(struct scroll_state *st)
+{
+    unsigned int i, row = topt.pos_changed ? topt.y : topt.y / 2;
+    char buf[BUFMAX];
+
+    while (next_shown(buf, sizeof(buf), st)) {
+        st->line++;
+        run_pipeline(buf, st);
+        wattrset(pscroll->scrollwin, st->attr);
+
+        for (i = 0; st->out[i] != '\0'; i++) {
+            st->status(st);
+            mvwaddch(pscroll->scrollwin, row, i, (unsigned char)st->out[i]);
+            nap(st->scroll_speed);
+            wrefresh(pscroll->scrollwin);
+            output_account(FALSE);
+            mirror_frame();
+            user_input(st);
+
+            if (tmatch.jump >= 0) {
+                break;
+            }
+        }
+
+        if (st->matched) {
+            highlight_word(st);
+        }
+
+        wclear(pscroll->scrollwin);
+        wrefresh(pscroll->scrollwin);
+        output_account(TRUE);
+        mirror_frame();
+        match_jump(&st->line);
+    } 
+}
+
+/* --benchmark: time the per-line pipeline this run would use over the
+   whole text, without the terminal or any delays, against the per-line
+   work the scroll loop did before there was a pipeline */
+void benchmark(void)
+{
+    FILE *fp;
+    char **lines = NULL, buf[BUFMAX];
+    unsigned long int n = 0, alloced = 0, i, runs;
+    struct scroll_state st;
+    double ns, before, flush;
+
+    while (tfile.growing) { /* measure the whole text, not what's there yet */
+        napms(10);
+    }
+
+    if (!(fp = fopen(tfile.text_file, "r"))) {
+        my_perror("fopen()");
+    }
+
+    while (fgets(buf, sizeof buf, fp)) {
+        if (n == alloced) {
+            alloced = alloced ? alloced * 2 : 1024;
+            if (!(lines = (char **)realloc(lines, alloced * sizeof(char *)))) {
+                my_perror("realloc()");
+            }
+        }
+
+        if (!(lines[n++] = strdup(buf))) {
+            my_perror("strdup()");
+        }
+    }
+
+    fclose(fp);
+
+    if (!n) {
+        return;
+    }
+
+    memset(&st, 0, sizeof st);
+    st.toggle = topt.statusbar;
+    st.scroll_speed = st.origspeed = topt.default_speed;
+    build_pipeline(&st);
+    runs = n < 1000000 ? 1000000 / n : 1;
+
+    ns = benchmark_run(lines, n, runs, run_pipeline, &st);
+    before = benchmark_run(lines, n, runs, benchmark_before, &st);
+    flush = benchmark_run(lines, n, runs, benchmark_flush, &st);
+
+    printf("%u stage%s, %lu lines x %lu runs: %.1f ns/line\n", 
+        tpipeline.count, tpipeline.count == 1 ? "" : "s", n, runs, ns);
+    printf("before the pipeline: %.1f ns/line, %.1f of it flushinp()%s\n",
+        before, flush, isatty(STDIN_FILENO) ? "" : 
+        " (stdin isn't a terminal, so that's less than it would be)");
+
+    for (i = 0; i < n; i++) {
+        free(lines[i]);
+    }
+
+    free(lines);
+}
+
+/* ns per line for one way of handling the lines */
+double benchmark_run(char **lines, unsigned long int n, unsigned long int runs,
+                     void (*handle)(char *, struct scroll_state *), 
+                     struct scroll_state *st)
+{
+    char work[BUFMAX];
+    unsigned long int i, run;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (run = 0; run < runs; run++) {
+        for (i = 0; i < n; i++) {
+            strcpy(work, lines[i]); /* what fgets() costs the real loop */
+            st->line = i + 1;
+            handle(work, st);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return ((end.tv_sec - start.tv_sec) * 1e9 + 
+            (end.tv_nsec - start.tv_nsec)) / ((double)n * runs);
+}
+
+/* What the scroll loop did for every line before build_pipeline(), short
+   of drawing: flush typeahead, look for -w (or "textscroll") whether or
+   not it was given, change case in place and check the status bar. */
+void benchmark_before(char *buf, struct scroll_state *st)
+{
+    char *p;
+
+    benchmark_flush(buf, st);
+    match_advance(st->line);
+    st->matched = strstr(buf, topt.special_word) != NULL;
+
+    if (topt.case_change) {
+        for (p = buf; *p; p++) {
+            *p = topt.case_type == LOWERCASE ? tolower(*p) : toupper(*p);
+        }
+    }
+
+    if (topt.statusbar && st->toggle && status_due()) {
+        st->attr = st->matched ? A_BOLD : A_NORMAL;
+    }
+}
+
+/* flushinp() without a screen set up: the tcflush() it makes */
+void benchmark_flush(char *buf, struct scroll_state *st)
+{
+    tcflush(STDIN_FILENO, TCIFLUSH);
+}
+
+off_t file_size(FILE *fp)
+{
+    off_t len = 0;
+
+    fseeko(fp, 0, SEEK_END);
+    len = ftello(fp);
+    fseeko(fp, 0, SEEK_SET);
+
+    return(len);
+}
+
+int wr_open(struct window_reader *wr, char *path)
+{
+    struct stat sb;
+
+    if ((wr->fd = open(path, O_RDONLY)) < 0) {
+        return -1;
+    }
+
+    if (fstat(wr->fd, &sb) < 0) {
+        close(wr->fd);
+        return -1;
+    }
+
+    wr->size = sb.st_size;
+    wr->map = NULL;
+    wr->base = wr->pos = 0;
+    wr->len = 0;
+    wr->window = WINDOW_SIZE;
+    wr->random = FALSE;
+
+    posix_fadvise(wr->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    return 0;
+}
+
+/* For skimming: map a few pages around each sample and tell the kernel
+   not to read ahead, so the I/O goes with the number of samples rather
+   than the size of the file */
+void wr_sample(struct window_reader *wr)
+{
+    if (wr->map) {
+        munmap(wr->map, wr->len);
+        posix_fadvise(wr->fd, wr->base, wr->len, POSIX_FADV_DONTNEED);
+        wr->map = NULL;
+    }
+
+    wr->window = SKIM_WINDOW;
+    wr->random = TRUE;
+    posix_fadvise(wr->fd, 0, 0, POSIX_FADV_RANDOM);
+}
+
+void wr_close(struct window_reader *wr)
+{
+    if (wr->map) {
+        munmap(wr->map, wr->len);
+        posix_fadvise(wr->fd, wr->base, wr->len, POSIX_FADV_DONTNEED);
+    }
+
+    if (wr->fd >= 0) {
+        close(wr->fd);
+    }
+
+    wr->map = NULL;
+    wr->fd = -1;
+}
+
+/* Map the window holding pos, telling the kernel it can drop the one
+   we've finished with instead of keeping it cached. */
+int wr_map(struct window_reader *wr, off_t pos)
+{
+    off_t base = pos - (pos % sysconf(_SC_PAGESIZE));
+    size_t len = wr->size - base < (off_t)wr->window ? wr->size - base 
+                                                      : wr->window;
+
+    if (wr->map) {
+        munmap(wr->map, wr->len);
+        posix_fadvise(wr->fd, wr->base, wr->len, POSIX_FADV_DONTNEED);
+        wr->map = NULL;
+    }
+
+    if (!len) {
+        return -1;
+    }
+
+    wr->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, wr->fd, base);
+
+    if (wr->map == MAP_FAILED) {
+        wr->map = NULL;
+        return -1;
+    }
+
+    madvise(wr->map, len, wr->random ? MADV_RANDOM : MADV_SEQUENTIAL);
+    wr->base = base;
+    wr->len = len;
+
+    return 0;
+}
+
+/* see if the file has grown since we last looked */
+int wr_grow(struct window_reader *wr)
+{
+    struct stat sb;
+
+    if (fstat(wr->fd, &sb) < 0 || sb.st_size <= wr->size) {
+        return 0;
+    }
+
+    wr->size = sb.st_size;
+
+    return 1;
+}
+
+/* fgets() on the window: at most size - 1 bytes, stopping after a newline */
+char *wr_gets(struct window_reader *wr, char *buf, int size)
+{
+    int n = 0;
+    size_t take;
+    char *src, *nl = NULL;
+
+    while (n < size - 1 && !nl) {
+        if (wr->pos >= wr->size && !wr_grow(wr)) {
+            break;
+        }
+
+        if (!wr->map || wr->pos < wr->base || wr->pos >= wr->base + 
+            (off_t)wr->len) {
+            if (wr_map(wr, wr->pos) < 0) {
+                break;
+            }
+        }
+
+        src = wr->map + (wr->pos - wr->base);
+        take = wr->base + wr->len - wr->pos;
+
+        if (take > (size_t)(size - 1 - n)) {
+            take = size - 1 - n;
+        }
+
+        if ((nl = memchr(src, '\n', take))) {
+            take = (nl - src) + 1;
+        }
+
+        memcpy(buf + n, src, take);
+        n += take;
+        wr->pos += take;
+    }
+
+    if (!n) {
+        return NULL;
     }
+
+    buf[n] = '\0';
+
+    return buf;
+}
+
+void wr_seek(struct window_reader *wr, off_t pos)
+{
+    wr->pos = pos;
 }
 
-void lesspipe(void)
+/* len bytes at pos straight out of the window, sliding it if need be */
+char *wr_peek(struct window_reader *wr, off_t pos, size_t len)
 {
-    FILE *fp_read, *fp_write;
-    char *c, buf[BUFMAX], command[BUFMAX], lesscommand[BUFMAX], *lesspipe;
-    unsigned long int empty = 0;
-    char qfilename[BUFMAX]; /* quoted filename */
+    if (pos + (off_t)len > wr->size) {
+        wr_grow(wr);
+    }
 
-    printf("Loading...\n");
+    if (!wr->map || pos < wr->base || pos + len > wr->base + wr->len) {
+        if (wr_map(wr, pos) < 0) {
+            return NULL;
+        }
+    }
 
-    /* $LESSOPEN will look like:  |/usr/bin/lesspipe.sh %s */
-    lesspipe = getenv("LESSOPEN");
+    if (pos + len > wr->base + wr->len) {
+        return NULL;
+    }
 
-    if (lesspipe) {
-        /* strip off the leading | */ 
-        if ((c = strchr(lesspipe, '|'))) {
-            strncpy(lesscommand, c + 1, strlen(c + 1));
+    wr->pos = pos + len;
 
-            /* redirection */
-            if (check_if_pdf(tfile.filename)) {
-                strncat(lesscommand, " - > ", 5); /* pdftotext needs the - */
-            } else {
-                strncat(lesscommand, " > ", 3);
-            }
+    return wr->map + (pos - wr->base);
+}
 
-            strncat(lesscommand, tfile.text_file, strlen(tfile.text_file));
-            /* add quotes for filenames containing spaces: */
-            snprintf(qfilename, sizeof qfilename, "\"%s\"", tfile.filename);
-            snprintf(command, (strlen(lesscommand) + strlen(qfilename)), 
-                lesscommand, qfilename);
-        }
+/* wr_gets() on a file that may still be growing: a last line that
+   hasn't got its newline yet is left for when the rest arrives */
+char *wr_gets_whole(struct window_reader *wr, char *buf, int size)
+{
+    off_t start = wr->pos;
+    unsigned int growing = tfile.growing;
+    size_t len;
 
-        system(command); /* run lesspipe.sh */
+    if (!wr_gets(wr, buf, size)) {
+        return NULL;
     }
 
-    if (!(fp_write = fopen(tfile.text_file, "r"))) {
-        my_perror("fopen()");
-    }
+    len = wr->pos - start;
 
-    if (file_size(fp_write) == 0) {
-        empty = 1;
+    if (growing && wr->pos >= wr->size && buf[len - 1] != '\n' &&
+        len < (size_t)(size - 1)) {
+        wr->pos = start;
+        return NULL;
     }
 
-    fclose(fp_write);
+    return buf;
+}
 
-    if (empty) {
+/* At the end of a file that's still being written, wait for more.
+   Returns 0 once it's really finished. */
+int wr_wait(struct window_reader *wr)
+{
+    unsigned int growing;
 
-        /* lesspipe didn't have any output, make the file ourselves */
-        if (!(fp_read = fopen(tfile.filename, "r"))) {
-            my_perror("fopen()");
-        }
+    for (;;) {
+        growing = tfile.growing;
 
-        if (!(fp_write = fopen(tfile.text_file, "w"))) {
-            my_perror("fopen()");
+        if (wr_grow(wr)) {
+            return 1;
         }
 
-        while (fgets(buf, sizeof buf, fp_read)) {
-            fprintf(fp_write, "%s", buf);
+        if (!growing) {
+            return 0;
         }
 
-        fclose(fp_read);
-        fclose(fp_write);
+        napms(100);
     }
 }
 
-int check_if_pdf(char *filename)
+/* Build the upper/lower case lookup tables once, and fold -w the ways
+   -i searches for it. */
+void init_case_tables(void)
 {
-    char *c;
+    unsigned int c;
 
-    if (strstr(filename, ".pdf")) {
-        if ((c = strrchr(filename, '.'))) {
-            if (!strncmp(c, ".pdf", 4)) {
-                return 1;
-            }
-        }
+    for (c = 0; c < 256; c++) {
+        upper_table[c] = toupper(c);
+        lower_table[c] = tolower(c);
     }
 
-    return 0;
+    topt.case_table = topt.case_type == UPPERCASE ? upper_table : lower_table;
+    fold_word();
 }
 
-void fmt(void)
+/* (Re)make the -i and -u/-l copies of -w, after it's been set or changed */
+void fold_word(void)
 {
-    char command[BUFMAX];
+    free(topt.folded_word);
+    free(topt.drawn_word);
 
-    snprintf(command, sizeof command, "fmt -s %s > %s", tfile.text_file, 
-        tfile.text_tmp);
+    if (!(topt.folded_word = (char *)malloc(strlen(topt.special_word) + 1)) ||
+        !(topt.drawn_word = (char *)malloc(strlen(topt.special_word) + 1))) {
+        my_perror("malloc()");
+    }
 
-    system(command);
+    fold_case(topt.folded_word, topt.special_word, lower_table);
+    fold_case(topt.drawn_word, topt.special_word, topt.case_table);
+}
 
-    if (unlink(tfile.text_file)) {
-        my_perror("unlink()");
+/* copy src to dst through a case table, returning the length */
+unsigned long int fold_case(char *dst, char *src, unsigned char *table)
+{
+    unsigned char *s = (unsigned char *)src, *d = (unsigned char *)dst;
+
+    while ((*d++ = table[*s])) {
+        s++;
     }
 
-    if (link(tfile.text_tmp, tfile.text_file) != 0) {
-        my_perror("link()");
+    return s - (unsigned char *)src;
+}
+
+/* a line matching -w has just been shown */
+void highlight_word(struct scroll_state *st)
+{
+    if (topt.beep_ok) {
+        beep(); 
     }
 
-    if (unlink(tfile.text_tmp)) {
-        my_perror("unlink()");
+    if (topt.auto_pause) {
+        wait_key(stdscr);
     }
 }
 
-/* Make it so you never have to stare at empty space */
-void strip_extra_blanks(void)
+int word_match(char *buf, char *word, char *folded)
 {
-    FILE *fp_read, *fp_write;
-    char buf[BUFMAX];
-    unsigned int blank = 0;
+    char fold[BUFMAX];
 
-    if (!(fp_read = fopen(tfile.text_file, "r+"))) {
-        my_perror("fopen()");
+    if (!topt.ignore_case) {
+        return strstr(buf, word) != NULL;
     }
 
-    if (!(fp_write = fopen(tfile.text_tmp, "w"))) {
-        my_perror("fopen()");
+    fold_case(fold, buf, lower_table);
+
+    return strstr(fold, folded) != NULL;
+}
+
+/* Record the offset of every line matching -w. Lines are read in the
+   same BUFMAX pieces scroll_it() uses so the line numbers agree. */
+void *match_indexer(void *arg)
+{
+    struct window_reader wr;
+    char buf[BUFMAX], *word, *folded;
+    unsigned long int line = 0;
+    unsigned int generation;
+    off_t offset = 0;
+
+    /* --control's "pattern" may change -w while this is going */
+    pthread_mutex_lock(&tmatch.lock);
+    generation = tmatch.generation;
+    word = strdup(topt.special_word);
+    folded = strdup(topt.folded_word);
+    pthread_mutex_unlock(&tmatch.lock);
+
+    if (!word || !folded) {
+        my_perror("strdup()");
     }
 
-    while (fgets(buf, sizeof buf, fp_read)) {
+    if (wr_open(&wr, tfile.text_file) < 0) {
+        tmatch.done = TRUE;
+        free(word);
+        free(folded);
+        return NULL;
+    }
 
-        /* Don't print 2+ blank lines */        
-        if (buf[0] == CARRIAGE_RETURN || buf[0] == LINEFEED) {
-            blank++;
-        } else {
-            blank = 0;
+    while (generation == tmatch.generation) {
+        if (!wr_gets_whole(&wr, buf, sizeof buf)) {
+            if (wr_wait(&wr)) {
+                continue;
+            }
+
+            if (!wr_gets(&wr, buf, sizeof buf)) {
+                break;
+            }
         }
 
-        if (blank == 2) {
-            blank = 1;
-            continue;
+        line++;
+
+        if (word_match(buf, word, folded)) {
+            pthread_mutex_lock(&tmatch.lock);
+
+            if (generation != tmatch.generation) { /* a new -w took over */
+                pthread_mutex_unlock(&tmatch.lock);
+                break;
+            }
+
+            if (tmatch.count == tmatch.alloced) {
+                tmatch.alloced = tmatch.alloced ? tmatch.alloced * 2 : 64;
+                tmatch.pos = (struct match_pos *)realloc(tmatch.pos, 
+                    tmatch.alloced * sizeof(struct match_pos));
+                if (!tmatch.pos) {
+                    my_perror("realloc()");
+                }
+            }
+
+            tmatch.pos[tmatch.count].line = line;
+            tmatch.pos[tmatch.count].offset = offset;
+            tmatch.count++;
+            pthread_mutex_unlock(&tmatch.lock);
         }
 
-        fprintf(fp_write, "%s", buf);
+        offset = wr.pos;
     }
 
-    fclose(fp_read);
-    fclose(fp_write);
+    wr_close(&wr);
+    free(word);
+    free(folded);
+    pthread_mutex_lock(&tmatch.lock);
 
-    if (unlink(tfile.text_file)) {
-        my_perror("unlink()");
+    if (generation == tmatch.generation) {
+        tmatch.done = TRUE;
     }
 
-    if (link(tfile.text_tmp, tfile.text_file) != 0) {
-        my_perror("link()");
+    pthread_mutex_unlock(&tmatch.lock);
+
+    return NULL;
+}
+
+void start_match_index(void)
+{
+    if (tmatch.running) {
+        return;
     }
 
-    if (unlink(tfile.text_tmp)) {
-        my_perror("unlink()");
+    trot.lazy = FALSE; /* matches past the decoded part too */
+
+    if (pthread_create(&tmatch.indexer, NULL, match_indexer, NULL) != 0) {
+        cperror("pthread_create()");
     }
+
+    pthread_detach(tmatch.indexer);
+    tmatch.running = TRUE;
 }
 
-void scroll_it(unsigned int scroll_speed, int argc, char *filename_nodashf, 
-               char *progname)
+/* keep tmatch.current in step with the line on screen */
+void match_advance(unsigned long int line)
 {
-    char buf[BUFMAX], *s;
-    unsigned int origspeed = scroll_speed, toggle = ON;
-    unsigned long int total_lines = 0, line = 0;
+    if (!tmatch.running) {
+        return;
+    }
 
-    topt.y = LINES - 2;
+    pthread_mutex_lock(&tmatch.lock);
 
-    if (topt.pos_changed) {
-        topt.y = topt.pos_changed;
+    while (tmatch.current < tmatch.count && 
+           tmatch.pos[tmatch.current].line <= line) {
+        tmatch.current++;
     }
 
-    if ((topt.y > LINES - 2) || (topt.y < 1)) {
-        usage(progname);
-    }
+    pthread_mutex_unlock(&tmatch.lock);
+}
 
-    if (!tfile.piped)  { /* if they used -f */
+/* Queue a jump to the next (direction 1) or previous (-1) match. The
+   status bar calls the last match passed "match k", so previous is k-1. */
+void match_request(int direction)
+{
+    long target;
 
-        if (!(tfile.fp = fopen(tfile.text_file, "r"))) {
-            cperror("fopen()");
-        }
+    pthread_mutex_lock(&tmatch.lock);
 
-        tfile.which = tfile.fp;
-        total_lines = get_total_lines(tfile.which);
+    if (direction > 0) {
+        target = tmatch.current;
+    } else {
+        target = (long)tmatch.current - 2;
+    }
 
-    } else { 
+    if (target >= 0 && target < (long)tmatch.count) {
+        tmatch.jump = target;
+    } else if (topt.beep_ok) {
+        beep();
+    }
 
-        if (!(tfile.which = fopen(tfile.text_pipe, "r"))) {
-            cperror("fopen()");
-        }
+    pthread_mutex_unlock(&tmatch.lock);
+}
 
-        tfile.display_filename = "piped output";
-        total_lines = get_total_lines(tfile.which);
+/* Carry out a queued jump so the match is the next line read */
+int match_jump(unsigned long int *line)
+{
+    struct match_pos to;
+
+    /* the indexer reallocs pos, and a new -w starts it over */
+    pthread_mutex_lock(&tmatch.lock);
+
+    if (tmatch.jump < 0 || tmatch.jump >= (long)tmatch.count) {
+        tmatch.jump = -1;
+        pthread_mutex_unlock(&tmatch.lock);
+        return 0;
     }
 
-    tfile.the_file_size = file_size(tfile.which);
+    to = tmatch.pos[tmatch.jump];
+    tmatch.current = tmatch.jump;
+    tmatch.jump = -1;
+    pthread_mutex_unlock(&tmatch.lock);
+
+    wr_seek(&twin, to.offset);
+    *line = to.line - 1;
+    tfile.page_num = (*line / LINES) + 1;
+    wclear(pscroll->scrollwin);
+
+    return 1;
+}
+
+void get_stats(unsigned long int total_lines, unsigned long int line)
+{
+    time_t now;
+    struct tm *tmptr;
+    char sdate[64];
+
+    time(&now);
+    tmptr = localtime(&now);
+    strftime(sdate, sizeof sdate, "%a %b %d  %I:%M:%S%p", tmptr);
 
-    if (topt.scrollmode_chars) {
-        char_scroll(scroll_speed);
+    /* until the lines are counted, go by how far into the file we are */
+    if (trsvp.active && trsvp.done && trsvp.count) {
+        tfile.percent = ((double)trsvp.current / trsvp.count) * 100;
+    } else if (trsvp.active && twin.size) {
+        tfile.percent = ((double)twin.pos / (double)twin.size) * 100;
+    } else if (tpdf.active && !tcount.done) {
+        tfile.percent = ((double)(pdf_page_at(twin.pos) - 1) / tpdf.pages) * 100;
+    } else if (trot.active && tfile.growing && trot.estimate) {
+        tfile.percent = ((double)twin.pos / (double)trot.estimate) * 100;
+    } else if (!tfile.piped && !tcount.done && twin.size) {
+        tfile.percent = ((double)twin.pos / (double)twin.size) * 100;
+    } else if (total_lines) {
+        tfile.percent = ((double)line / (double)total_lines) * 100;
     } else {
-        scrollok(pscroll->scrollwin, TRUE);
+        tfile.percent = 0;
+    }
 
-        while ((s = fgets(buf, sizeof(buf), tfile.which))) { /* scroll time */
-            flushinp();
-            line++;
+    wbkgd(pstat->statwin, A_REVERSE);
 
-            if (topt.statusbar) {
-                if (toggle) {
-                    get_stats(total_lines, line);
-                }
-            }
+    if ((line % LINES) == 0) {
+        tfile.page_num++;
+    }
 
-            highlight_word(buf, scroll_speed, origspeed, toggle, total_lines, line);
+    if (trsvp.active) {
+        mvwprintw(pstat->statwin, 0, 0, "Word %lu/%lu%s - %.0f%%  %.0f wpm - %s",
+            trsvp.current, trsvp.count, trsvp.done ? "" : "+", tfile.percent,
+            trsvp.speed, tfile.display_filename);
+    } else if (tskim.active) {
+        mvwprintw(pstat->statwin, 0, 0, "~%ld/~%ld - %.0f%%  Page: %ld - %s",
+            line, total_lines, tfile.percent, tfile.page_num, 
+            tfile.display_filename);
+    } else {
+        mvwprintw(pstat->statwin, 0, 0, "%ld/%ld%s - %.0f%%  Page: %ld - %s", 
+            line, total_lines, !tfile.piped && !tcount.done ? "+" : "", 
+            tfile.percent, tfile.page_num, tfile.display_filename);
+    }
 
-            if (topt.case_change) {
-                change_case(buf, topt.case_type);
-            }
+    if (tpipe.dropped) {
+        wprintw(pstat->statwin, " - %lu dropped", tpipe.dropped);
+    }
 
-            mvwprintw(pscroll->scrollwin, topt.y, 0, "%s", buf);
-            napms(scroll_speed);
-            scroll(pscroll->scrollwin);
-            wrefresh(pscroll->scrollwin);
-            user_input(&scroll_speed, origspeed, &toggle, total_lines, line);
-        }
+    if (tpack.count) {
+        pthread_mutex_lock(&tpipe.lock);
+        wprintw(pstat->statwin, " - %.1fM packed in %.1fM", 
+            tpack.used / 1048576.0, tpack.zused / 1048576.0);
+        pthread_mutex_unlock(&tpipe.lock);
+    }
 
-        get_stats(total_lines, line); /* see stats at eof */
-        wgetch(pscroll->scrollwin);
-        fclose(tfile.which);
+    if (tahead.stalled) {
+        wprintw(pstat->statwin, " - buffering");
+    } else if (tahead.size) {
+        wprintw(pstat->statwin, " - buffer %d%%", readahead_fill());
     }
-}
 
-void char_scroll(unsigned int scroll_speed)
-{
-    unsigned int i, line = 0;
-    char buf[BUFMAX], *s;
-    unsigned int origspeed = scroll_speed, toggle = ON;
-    unsigned long int total_lines = get_total_lines(tfile.which);
-  
-    while ((s = fgets(buf, sizeof(buf), tfile.which))) {
-        line++;
-        highlight_word(buf, scroll_speed, origspeed, toggle, total_lines, line);
+    if (tcollapse.active) {
+        wprintw(pstat->statwin, " - %lu shown, %lu collapsed", 
+            tcollapse.shown, tcollapse.suppressed);
+    }
 
-        if (topt.case_change) {
-            change_case(buf, topt.case_type);
+    if (tskim.lines) {
+        wprintw(pstat->statwin, " - skim 1 in %lu", tskim.lines);
+    } else if (tskim.active) {
+        wprintw(pstat->statwin, " - skim every %lluK", 
+            (unsigned long long)tskim.stride / 1024);
+    }
+
+    if (tpdf.active) {
+        wprintw(pstat->statwin, " - PDF page %lu of %lu", 
+            pdf_page_at(twin.pos), tpdf.pages);
+
+        if (tfile.growing) {
+            wprintw(pstat->statwin, " (%lu converted)", tpdf.extracted);
         }
+    }
 
-        if (topt.highlight) {
-            topt.highlight = FALSE;
-            wclear(pscroll->scrollwin);
-            wrefresh(pscroll->scrollwin);
-            continue;
+    if (trep.active) {
+        wprintw(pstat->statwin, " - replay %gx", trep.speed);
+
+        if (trep.have_last) {
+            wprintw(pstat->statwin, " @ %02ld:%02ld:%02ld", 
+                ((long)trep.last / 3600) % 24, ((long)trep.last / 60) % 60,
+                (long)trep.last % 60);
         }
+    }
 
-        for (i = 0; buf[i] != '\0'; i++) {
+    if (trot.active) {
+        wprintw(pstat->statwin, " - %lu/%lu %s", 
+            rotated_segment_at(twin.pos) + 1, trot.segments, 
+            get_basename(trot.seg[rotated_segment_at(twin.pos)].name));
+    }
 
-            if (topt.statusbar) {
-                if (toggle) {
-                    get_stats(total_lines, line);
-                }
-            }
+    if (tarc.active) {
+        wprintw(pstat->statwin, " - member %lu of %lu%s",
+            archive_member_at(twin.pos), tarc.count, tarc.listed ? "" : "+");
 
-            if (topt.reshow_statusbar) {
-                get_stats(total_lines, line); /* see status bar */
-                topt.reshow_statusbar = FALSE;
-            }
+        if (tfile.growing) {
+            wprintw(pstat->statwin, " (%lu decoded)", tarc.written);
+        }
+    }
 
-            if (topt.pos_changed) {
-                mvwprintw(pscroll->scrollwin, topt.y, i, "%c", buf[i]);
-            } else {
-                mvwprintw(pscroll->scrollwin, topt.y / 2, i, "%c", buf[i]);
-            }
+    if (tmatch.running) {
+        pthread_mutex_lock(&tmatch.lock);
+        wprintw(pstat->statwin, " - match %lu of %lu%s", tmatch.current, 
+            tmatch.count, tmatch.done ? "" : "+");
 
-            napms(scroll_speed); 
-            wrefresh(pscroll->scrollwin);
-            user_input(&scroll_speed, origspeed, &toggle, total_lines, line);
+        if (tmatch.count && total_lines) {
+            wprintw(pstat->statwin, ", 1 per %lu lines", 
+                total_lines / tmatch.count);
         }
 
-        wclear(pscroll->scrollwin);
-        wrefresh(pscroll->scrollwin);
-    } 
+        pthread_mutex_unlock(&tmatch.lock);
+    }
+
+    wclrtoeol(pstat->statwin); /* the text above can get shorter */
+    mvwprintw(pstat->statwin, 0, COLS - 23, "%s", sdate);
 
-    get_stats(total_lines, line); /* see stats at EOF */
-    wgetch(pscroll->scrollwin);
-    fclose(tfile.which);
+    wrefresh(pstat->statwin);
 }
 
-int file_size(FILE *fp)
+/* Only repaint the status bar every few seconds on a capped link; the
+   ticking clock alone would otherwise cost a redraw per line. */
+int status_due(void)
 {
-    unsigned long int len = 0;
+    time_t now;
 
-    fseek(fp, 0, SEEK_END);
-    len = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    if (!topt.bandwidth) {
+        return 1;
+    }
 
-    return(len);
+    time(&now);
+
+    if (now - tout.last_status < BW_STATUS_INTERVAL) {
+        return 0;
+    }
+
+    tout.last_status = now;
+
+    return 1;
 }
 
-void change_case(char *buf, int choice)
+void output_setup(void)
 {
-    char *p;
+    clock_gettime(CLOCK_MONOTONIC, &tout.stamp);
+    tout.credit = topt.bandwidth / 4;
+    output_baseline();
+}
 
-    for (p = buf; *p != '\0'; p++) {
-        if (choice == LOWERCASE) {
-            *p = tolower(*p);
-        } else {
-            *p = toupper(*p);
-        }
+/* For --bandwidth: a SCREEN that writes to a pty of ours rather than
+   straight to out, so every byte it sends can be counted on the way. Keys are still
+   read from in, which gets the modes curses would have given it. */
+SCREEN *output_screen(FILE *out, FILE *in)
+{
+    struct termios t;
+    struct winsize ws;
+    SCREEN *sp;
+    FILE *fp;
+
+    tout.tty = fileno(out);
+    tout.tty_in = fileno(in);
+
+    if (!isatty(tout.tty) && isatty(STDERR_FILENO)) { /* as curses does */
+        tout.tty = STDERR_FILENO;
+    }
+
+    if ((tout.master = posix_openpt(O_RDWR|O_NOCTTY)) < 0 || 
+        grantpt(tout.master) || unlockpt(tout.master) ||
+        (tout.slave = open(ptsname(tout.master), O_RDWR|O_NOCTTY)) < 0) {
+        my_perror("can't count terminal output: posix_openpt()");
+    }
+
+    fcntl(tout.master, F_SETFD, FD_CLOEXEC); /* not for the editor */
+    fcntl(tout.slave, F_SETFD, FD_CLOEXEC);
+    fcntl(tout.master, F_SETFL, O_NONBLOCK);
+
+    if (ioctl(tout.tty, TIOCGWINSZ, &ws) == 0) {
+        ioctl(tout.slave, TIOCSWINSZ, &ws);
+    }
+
+    /* curses sets the pty's modes; the real terminal needs its keys
+       unbuffered and unechoed (^C still works), and the output, which
+       the pty has already processed, passed through as it is */
+    if (tcgetattr(tout.tty_in, &tout.saved) == 0 && 
+        tcgetattr(tout.tty, &tout.saved_out) == 0) {
+        tout.restore = TRUE;
+        t = tout.saved;
+        t.c_lflag &= ~(ICANON | ECHO | ECHONL | IEXTEN);
+        t.c_iflag &= ~(ICRNL | INLCR | IGNCR);
+        t.c_cc[VMIN] = 1;
+        t.c_cc[VTIME] = 0;
+        tcsetattr(tout.tty_in, TCSANOW, &t);
+
+        tcgetattr(tout.tty, &t); /* the same terminal, most likely */
+        t.c_oflag &= ~OPOST;
+        tcsetattr(tout.tty, TCSANOW, &t);
     }
-} 
 
-void highlight_word(char *buf, unsigned int scroll_speed, unsigned int origspeed,
-                    unsigned int toggle, unsigned long int total_lines,
-                    unsigned long int line)
+    atexit(output_end);
+
+    if (pthread_create(&tout.relay, NULL, output_relay, NULL) != 0) {
+        my_perror("pthread_create()");
+    }
+
+    if (!(fp = fdopen(tout.slave, "w")) || !(sp = newterm(NULL, fp, in))) {
+        my_perror("newterm()");
+    }
+
+    return sp;
+}
+
+/* pass on whatever curses writes as soon as it's there */
+void *output_relay(void *arg)
 {
-    unsigned int i = 0;
+    struct pollfd pfd;
 
-    /* highlight the entire line special_word is on */
-    if (strstr(buf, topt.special_word)) {
-        topt.highlight = TRUE;
-        wattrset(pscroll->scrollwin, A_BOLD);
+    pfd.fd = tout.master;
+    pfd.events = POLLIN;
 
-        if (topt.beep_ok) {
-            beep(); 
+    for (;;) {
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            break;
         }
 
-        if (topt.scrollmode_chars) {
+        pthread_mutex_lock(&tout.lock);
+        output_pump();
+        pthread_mutex_unlock(&tout.lock);
+    }
+
+    return NULL;
+}
 
-            /* print again to see correctly */
-            for (i = 0; buf[i] != '\0'; i++) {
+/* With tout.lock held: count and send on all there is to read. A read
+   right after curses has written gets all of it, so the count after a
+   refresh is exact. */
+void output_pump(void)
+{
+    char buf[PIPE_CHUNK];
+    ssize_t n, done, w;
 
-                if (topt.statusbar) {
-                    if (toggle) {
-                        get_stats(total_lines, line);
-                    }
-                }
+    while ((n = read(tout.master, buf, sizeof buf)) > 0) {
+        tout.relayed += n;
 
-                if (topt.pos_changed) {
-                    mvwprintw(pscroll->scrollwin, topt.y, i, "%c", buf[i]);
-                } else {
-                    mvwprintw(pscroll->scrollwin, topt.y / 2, i, "%c", buf[i]);
+        for (done = 0; done < n; done += w) {
+            if ((w = write(tout.tty, buf + done, n - done)) < 0) {
+                if (errno != EINTR && errno != EAGAIN) {
+                    break; /* the terminal's gone */
                 }
 
-                user_input(&scroll_speed, origspeed, &toggle, total_lines, line);
-                napms(scroll_speed);
-                wrefresh(pscroll->scrollwin);
+                w = 0;
             }
         }
+    }
+}
 
-        if (topt.auto_pause) {
-            wrefresh(pscroll->scrollwin);
-            nodelay(stdscr, FALSE);
-            getch();
-        }
+/* the real terminal was resized: tell curses' pty */
+void output_resize(void)
+{
+    struct winsize ws;
 
-    } else {
-        wattrset(pscroll->scrollwin, A_NORMAL);
+    if (tout.slave >= 0 && ioctl(tout.tty, TIOCGWINSZ, &ws) == 0) {
+        ioctl(tout.slave, TIOCSWINSZ, &ws);
     }
 }
 
-void get_stats(unsigned long int total_lines, unsigned long int line)
+/* Send on the last of curses' output, e.g. from endwin(), and put the
+   terminal back the way it was. At exit, and before exec'ing. */
+void output_end(void)
 {
-    time_t now;
-    struct tm *tmptr;
-    char sdate[64];
+    if (tout.master < 0) {
+        return;
+    }
 
-    time(&now);
-    tmptr = localtime(&now);
-    strftime(sdate, sizeof sdate, "%a %b %d  %I:%M:%S%p", tmptr);
+    output_written();
 
-    tfile.percent = (((float)line / (float)total_lines) * 100);
+    if (tout.restore) {
+        tcsetattr(tout.tty, TCSADRAIN, &tout.saved_out);
+        tcsetattr(tout.tty_in, TCSADRAIN, &tout.saved);
+    }
+}
 
-    wbkgd(pstat->statwin, A_REVERSE);
+/* bytes curses has sent so far, including anything the relay hasn't
+   got to yet */
+unsigned long long output_written(void)
+{
+    unsigned long long n;
 
-    if ((line % LINES) == 0) {
-        tfile.page_num++;
+    if (tout.master < 0) {
+        return 0;
     }
 
-    mvwprintw(pstat->statwin, 0, 0, "%ld/%ld - %.0f%%  Page: %ld - %s", line,
-        total_lines, tfile.percent, tfile.page_num, tfile.display_filename);
+    pthread_mutex_lock(&tout.lock);
+    output_pump();
+    n = tout.relayed;
+    pthread_mutex_unlock(&tout.lock);
 
-    mvwprintw(pstat->statwin, 0, COLS - 23, "%s", sdate);
+    return n;
+}
 
-    wrefresh(pstat->statwin);
+/* forget anything written since the last count, e.g. the 'i' screen */
+void output_baseline(void)
+{
+    tout.wchar = output_written();
+}
+
+/* Count what the last refresh sent and, with --bandwidth, sleep until the
+   link has caught up. The bucket only holds a quarter second of credit so
+   lines keep arriving evenly instead of in bursts. */
+void output_account(unsigned int end_of_line)
+{
+    unsigned long long now_written = output_written();
+    unsigned long long sent = now_written - tout.wchar;
+    struct timespec now;
+    long elapsed_ms;
+
+    if (tlat.active) {
+        latency_frame();
+    }
+
+    tout.wchar = now_written;
+    tout.pending += sent;
+    tout.total += sent;
+
+    if (end_of_line) {
+        tout.last_line = tout.pending;
+        tout.pending = 0;
+        tout.lines++;
+    }
+
+    if (!topt.bandwidth) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ms = (now.tv_sec - tout.stamp.tv_sec) * 1000 +
+                 (now.tv_nsec - tout.stamp.tv_nsec) / 1000000;
+    tout.stamp = now;
+
+    tout.credit += (long)((elapsed_ms * topt.bandwidth) / 1000);
+
+    if (tout.credit > (long)(topt.bandwidth / 4)) {
+        tout.credit = topt.bandwidth / 4;
+    }
+
+    tout.credit -= (long)sent;
+
+    if (tout.credit < 0) {
+        napms((int)((-tout.credit * 1000) / topt.bandwidth));
+        clock_gettime(CLOCK_MONOTONIC, &tout.stamp);
+        tout.credit = 0;
+    }
 }
 
 void get_editor(void)
@@ -867,20 +6267,24 @@ char *get_basename(char *editor)
 
 }
 
-void user_input(unsigned int *scroll_speed, unsigned int origspeed, 
-                unsigned int *toggle, unsigned long int total_lines,
-                unsigned long int line)
+void user_input(struct scroll_state *st)
 {
+    control_poll();
+    user_action(st, get_key());
+}
 
-    switch (get_key()) {
+/* what a key (or a --control command) does; see get_key() */
+void user_action(struct scroll_state *st, unsigned int action)
+{
+    switch (action) {
         case 1:
-            if (*scroll_speed != 1) { /* speed up */
-                *scroll_speed = 1;
+            if (st->scroll_speed != 1) { /* speed up */
+                st->scroll_speed = 1;
             } else {
                 if (topt.new_speed) {
-                    *scroll_speed = topt.new_speed;
+                    st->scroll_speed = topt.new_speed;
                 } else {
-                    *scroll_speed = origspeed; /* stop speeding */
+                    st->scroll_speed = st->origspeed; /* stop speeding */
                 }
             }
             break;
@@ -888,29 +6292,28 @@ void user_input(unsigned int *scroll_speed, unsigned int origspeed,
             quit_cleanly();
             break;
         case 3:
-            *scroll_speed = origspeed;
+            st->scroll_speed = st->origspeed;
             topt.new_speed = 0;
             break;
         case 4:
-            if (topt.statusbar) {
-                if (toggle) {
-                    get_stats(total_lines, line);
-                }
+            if (topt.statusbar && st->toggle) {
+                get_stats(st->total_lines, st->line);
             }
-            nodelay(stdscr, FALSE);	
-            getch();
+            wait_key(stdscr);
             break;
         case 5:
             if (!topt.statusbar) {
                 topt.statusbar = ON;
             }
-            *toggle = ON;
+            st->toggle = ON;
+            build_pipeline(st);
             break;
         case 6:
             if (!topt.statusbar) {
                break;
             }
-            *toggle = OFF;
+            st->toggle = OFF;
+            build_pipeline(st);
             wbkgd(pstat->statwin, A_NORMAL);
             wclear(pstat->statwin);
             wrefresh(pstat->statwin);
@@ -920,12 +6323,12 @@ void user_input(unsigned int *scroll_speed, unsigned int origspeed,
             wrefresh(pscroll->scrollwin);
             break;
         case 8: 
-            *scroll_speed -= ((*scroll_speed * 25) / 100);
-            topt.new_speed = *scroll_speed; 
+            st->scroll_speed -= ((st->scroll_speed * 25) / 100);
+            topt.new_speed = st->scroll_speed; 
             break;
         case 9:
-            *scroll_speed += ((*scroll_speed * 25) / 100);
-            topt.new_speed = *scroll_speed; 
+            st->scroll_speed += ((st->scroll_speed * 25) / 100);
+            topt.new_speed = st->scroll_speed; 
             break;
         case 10:
             topt.auto_pause ^= 1; /* toggle */
@@ -933,10 +6336,29 @@ void user_input(unsigned int *scroll_speed, unsigned int origspeed,
         case 11:
             if (topt.beep_ok) 
                 beep();
-            show_info(*scroll_speed, origspeed, total_lines, line);
+            show_info(st->scroll_speed, st->origspeed, st->total_lines, st->line);
+
+            if (topt.statusbar && st->toggle) {
+                get_stats(st->total_lines, st->line); /* see status bar */
+            }
             break;
         case 12:
-            start_editor(line);
+            start_editor(st->line);
+            break;
+        case 13:
+            match_request(1);
+            break;
+        case 14:
+            match_request(-1);
+            break;
+        case 15:
+            hscroll_pan(-(long)COLS / 2);
+            break;
+        case 16:
+            hscroll_pan(COLS / 2);
+            break;
+        case 17:
+            hscroll_pan(-(long)thscroll.col);
             break;
     }
 
@@ -948,7 +6370,9 @@ unsigned int get_key(void)
 
     nodelay(stdscr, TRUE);
 
-    if ((key = getch()) != (unsigned long int)ERR) {
+    key = tlat.active ? latency_key() : getch();
+
+    if (key != (unsigned long int)ERR) {
         if (key == 32)  return 1;
         if (key == 'q') return 2;
         if (key == 'o') return 3;
@@ -961,11 +6385,316 @@ unsigned int get_key(void)
         if (key == 'a') return 10;
         if (key == 'i') return 11;
         if (key == 'e') return 12;
+        if (key == '>') return 13;
+        if (key == '<') return 14;
+        if (key == KEY_LEFT)  return 15;
+        if (key == KEY_RIGHT) return 16;
+        if (key == KEY_HOME)  return 17;
     }
 
     return 0;
 }
 
+/* --control: listen on the socket. Anything already there is only
+   replaced if it's a socket, e.g. one a killed run left behind. */
+void control_setup(void)
+{
+    struct sockaddr_un addr;
+    struct stat sb;
+    unsigned int i;
+
+    for (i = 0; i < CONTROL_CLIENTS; i++) {
+        tctl.client[i].fd = -1;
+    }
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, tctl.path, sizeof addr.sun_path - 1);
+
+    if (lstat(tctl.path, &sb) == 0 && S_ISSOCK(sb.st_mode)) {
+        unlink(tctl.path);
+    }
+
+    if ((tctl.fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(tctl.fd, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+        listen(tctl.fd, CONTROL_CLIENTS) < 0) {
+        cperror(tctl.path);
+    }
+
+    fcntl(tctl.fd, F_SETFL, O_NONBLOCK);
+    fcntl(tctl.fd, F_SETFD, FD_CLOEXEC);
+}
+
+/* Take on new connections and carry out whatever commands have come in
+   since last time, without ever waiting for more */
+void control_poll(void)
+{
+    char cmd[BUFMAX], *nl;
+    unsigned int i;
+    size_t n;
+    ssize_t got;
+    int fd;
+
+    if (tctl.fd < 0) {
+        return;
+    }
+
+    while ((fd = accept(tctl.fd, NULL, NULL)) >= 0) {
+        for (i = 0; i < CONTROL_CLIENTS && tctl.client[i].fd >= 0; i++)
+            ;
+
+        if (i == CONTROL_CLIENTS) {
+            control_reply(fd, "error too many connections\n");
+            close(fd);
+            continue;
+        }
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        tctl.client[i].fd = fd;
+        tctl.client[i].len = 0;
+    }
+
+    for (i = 0; i < CONTROL_CLIENTS; i++) {
+        if ((fd = tctl.client[i].fd) < 0) {
+            continue;
+        }
+
+        got = read(fd, tctl.client[i].buf + tctl.client[i].len, 
+                   sizeof tctl.client[i].buf - 1 - tctl.client[i].len);
+
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+            close(fd);
+            tctl.client[i].fd = -1;
+            continue;
+        }
+
+        if (got > 0) {
+            tctl.client[i].len += got;
+        }
+
+        /* Each command comes off the buffer before it's carried out,
+           since "pause" polls again from in here */
+        while (tctl.client[i].fd == fd && 
+               (nl = memchr(tctl.client[i].buf, '\n', tctl.client[i].len))) {
+            n = nl - tctl.client[i].buf;
+            memcpy(cmd, tctl.client[i].buf, n);
+            cmd[n && cmd[n - 1] == '\r' ? n - 1 : n] = '\0';
+            tctl.client[i].len -= n + 1;
+            memmove(tctl.client[i].buf, nl + 1, tctl.client[i].len);
+            control_command(fd, cmd);
+        }
+
+        if (tctl.client[i].len == sizeof tctl.client[i].buf - 1) {
+            control_reply(fd, "error command too long\n");
+            tctl.client[i].len = 0;
+        }
+    }
+}
+
+void control_reply(int fd, char *msg)
+{
+    send(fd, msg, strlen(msg), MSG_NOSIGNAL); /* a client that's gone is fine */
+}
+
+/* One command. The keys are named; see get_key() for what they do. */
+void control_command(int fd, char *cmd)
+{
+    static struct {
+        char *name;
+        unsigned int action;
+    } keys[] = {
+        { "fast", 1 }, { "quit", 2 }, { "original", 3 }, { "pause", 4 },
+        { "bar-on", 5 }, { "bar-off", 6 }, { "clear", 7 }, { "faster", 8 },
+        { "slower", 9 }, { "auto-pause", 10 }, { "next", 13 }, 
+        { "prev", 14 }, { "left", 15 }, { "right", 16 }, { "home", 17 },
+        { NULL, 0 }
+    };
+    struct scroll_state *st = tctl.st;
+    char *arg;
+    unsigned int i;
+
+    if ((arg = strchr(cmd, ' '))) {
+        *arg++ = '\0';
+    }
+
+    if (!strcmp(cmd, "speed")) {
+        if (!arg || !*arg || !char_check(arg) || !atoi(arg)) {
+            control_reply(fd, "error speed needs milliseconds\n");
+            return;
+        }
+
+        st->scroll_speed = topt.new_speed = atoi(arg);
+        control_reply(fd, "ok\n");
+    } else if (!strcmp(cmd, "resume")) {
+        tctl.wake = TRUE;
+        control_reply(fd, "ok\n");
+    } else if (!strcmp(cmd, "status")) {
+        control_status(fd);
+    } else if (!strcmp(cmd, "jump")) {
+        if (!arg || !*arg || !char_check(arg) || 
+            !control_jump(st, strtoul(arg, NULL, 10))) {
+            control_reply(fd, "error no such line\n");
+            return;
+        }
+
+        control_reply(fd, "ok\n");
+    } else if (!strcmp(cmd, "pattern")) {
+        control_pattern(st, arg ? arg : "");
+        control_reply(fd, "ok\n");
+    } else if (!strcmp(cmd, "load")) {
+        control_load(fd, arg);
+    } else {
+        for (i = 0; keys[i].name && strcmp(cmd, keys[i].name); i++)
+            ;
+
+        if (!keys[i].name) {
+            control_reply(fd, "error unknown command\n");
+            return;
+        }
+
+        control_reply(fd, "ok\n"); /* before "quit" or "pause" hold on */
+
+        if (keys[i].action == 4 && tctl.waiting) {
+            return; /* already paused, don't pause inside the pause */
+        }
+
+        user_action(st, keys[i].action);
+    }
+}
+
+/* one line of name=value pairs */
+void control_status(int fd)
+{
+    struct scroll_state *st = tctl.st;
+    char buf[BUFMAX * 2];
+    unsigned long int matches;
+
+    pthread_mutex_lock(&tmatch.lock);
+    matches = tmatch.count;
+    pthread_mutex_unlock(&tmatch.lock);
+
+    snprintf(buf, sizeof buf, "file=%s line=%lu total=%lu%s speed=%u "
+        "original=%u pattern=%s matches=%lu%s dropped=%lu collapsed=%lu "
+        "lines_drawn=%lu bytes_out=%llu buffer=%d stalls=%lu\n", 
+        tfile.piped ? "-" : tfile.filename, st->line, st->total_lines,
+        !tfile.piped && !tcount.done ? "+" : "", st->scroll_speed, 
+        st->origspeed, topt.word_given ? topt.special_word : "", matches,
+        tmatch.running && !tmatch.done ? "+" : "", tpipe.dropped, 
+        tcollapse.suppressed, tout.lines, tout.total, 
+        tahead.size ? readahead_fill() : 0, tahead.stalls);
+    control_reply(fd, buf);
+}
+
+/* Move so that line is the next one read, counting lines from where we
+   are or from the top. FALSE if the text isn't that long. */
+int control_jump(struct scroll_state *st, unsigned long int line)
+{
+    char buf[BUFMAX];
+    unsigned long int at = st->line;
+    off_t pos = twin.pos;
+
+    if (tfile.piped || trsvp.active || tskim.active || !line) {
+        return FALSE;
+    }
+
+    if (line <= at) {
+        wr_seek(&twin, 0);
+        at = 0;
+    }
+
+    for (; at + 1 < line; at++) {
+        if (!wr_gets_whole(&twin, buf, sizeof buf) && 
+            !wr_gets(&twin, buf, sizeof buf)) {
+            wr_seek(&twin, pos);
+            return FALSE;
+        }
+    }
+
+    st->line = at;
+    tfile.page_num = (at / LINES) + 1;
+    tcollapse.repeats = tcollapse.holding = 0;
+    wclear(pscroll->scrollwin);
+
+    pthread_mutex_lock(&tmatch.lock);
+    tmatch.current = 0;
+    pthread_mutex_unlock(&tmatch.lock);
+    match_advance(at);
+
+    return TRUE;
+}
+
+/* A new -w (or none). An indexer still going for the old one notices
+   the generation change and stops; it matches against copies of its
+   own, so the word can be swapped while it finishes its line. */
+void control_pattern(struct scroll_state *st, char *word)
+{
+    char *w = NULL;
+
+    if (*word && !(w = strdup(word))) {
+        cperror("strdup()");
+    }
+
+    pthread_mutex_lock(&tmatch.lock);
+    tmatch.generation++;
+    tmatch.count = tmatch.current = 0;
+    tmatch.jump = -1;
+    tmatch.running = tmatch.done = FALSE;
+    topt.word_given = w != NULL;
+
+    if (w) { /* an indexer still going has copies of its own */
+        free(tctl.word);
+        topt.special_word = tctl.word = w;
+        fold_word();
+    }
+
+    pthread_mutex_unlock(&tmatch.lock);
+
+    if (w && !tfile.piped && !trsvp.active && !tskim.active) {
+        start_match_index();
+    }
+
+    st->matched = FALSE;
+    build_pipeline(st);
+}
+
+/* Start over on another file as if it had been given with -f, in the
+   same process, terminal and socket */
+void control_load(int fd, char *file)
+{
+    char **argv;
+
+    if (!file || !*file || access(file, R_OK) != 0) {
+        control_reply(fd, "error can't read that file\n");
+        return;
+    }
+
+    if (tfile.piped) { /* stdin isn't a terminal to go back to */
+        control_reply(fd, "error not while reading a pipe\n");
+        return;
+    }
+
+    if (!(argv = (char **)calloc(tctl.argc + 3, sizeof(char *)))) {
+        cperror("calloc()");
+    }
+
+    memcpy(argv, tctl.argv, tctl.argc * sizeof(char *));
+    argv[tctl.argc] = "-f";
+    argv[tctl.argc + 1] = file;
+    control_reply(fd, "ok\n");
+
+    resume_save();
+    unlink(tfile.text_file);
+    mirror_end();
+    clear();
+    refresh();
+    endwin();
+    output_end();
+
+    execv("/proc/self/exe", argv);
+    cperror("execv()");
+}
+
 void show_info(unsigned int scroll_speed, unsigned int origspeed, 
                unsigned long int total_lines, unsigned long int line)
 {
@@ -1001,7 +6730,7 @@ void show_info(unsigned int scroll_speed, unsigned int origspeed,
     attrset(A_BOLD); 
     mvprintw(3, 1, "File Size: ");
     attrset(A_NORMAL);
-    mvprintw(3, 12, "%ld bytes", tfile.the_file_size);
+    mvprintw(3, 12, "%lld bytes", (long long)tfile.the_file_size);
 
     attrset(A_BOLD); 
     mvprintw(4, 1, "Current Dir: ");
@@ -1051,13 +6780,37 @@ void show_info(unsigned int scroll_speed, unsigned int origspeed,
     attrset(A_NORMAL);
     mvprintw(12, 25, "%s", topt.view_normal ? "No" : "Yes");
 
-    nodelay(stdscr, FALSE);
-    getch();
+    attrset(A_BOLD);
+    mvprintw(13, 1, "Output: ");
+    attrset(A_NORMAL);
+    if (topt.bandwidth) {
+        mvprintw(13, 9, "%llu bytes last line, %.1f bytes/line average",
+            tout.last_line, tout.lines ? (double)tout.total / tout.lines : 0.0);
+    } else {
+        mvprintw(13, 9, "not counted without --bandwidth");
+    }
+
+    attrset(A_BOLD);
+    mvprintw(15, 1, "Matches: ");
+    attrset(A_NORMAL);
+    mvprintw(15, 10, "%lu%s", tmatch.count, tmatch.done ? "" : " so far");
+
+    attrset(A_BOLD);
+    mvprintw(14, 1, "Bandwidth Cap: ");
+    attrset(A_NORMAL);
+
+    if (topt.bandwidth) {
+        mvprintw(14, 16, "%lu bytes/second", topt.bandwidth);
+    } else {
+        mvprintw(14, 16, "None");
+    }
+
+    wait_key(stdscr);
     clear(); 
     refresh();
     reset_prog_mode(); /* Return the screen */
     refresh(); /* needed to show the screen */
-    topt.reshow_statusbar = TRUE; 
+    output_baseline(); /* don't bill the info screen to the next line */
 }
 
 void usage(char *progname)
@@ -1069,6 +6822,7 @@ void usage(char *progname)
     "-w <string>     Highlight all lines that <string> appears on.\n"
     "-l              Display in all lower case characters.\n"
     "-u              Display in all upper case characters.\n"
+    "-i              Ignore case when matching the -w string.\n"
     "-c <color>      red, bgred, green, bggreen, blue, bgblue, yellow,\
  bgyellow, magenta, bgmagenta, bgwhite.\n"
     "-n              Don't take out extra blank lines. Display as is.\n" 
@@ -1079,6 +6833,51 @@ void usage(char *progname)
     "-b              Allow beeping on important events.\n"
     "-m              Scroll a character at a time mode.\n"
     "-t <ttyname>    Name of tty your running textscroll from while piped\n"
+    "                Give more -t's to show the scroll on those ttys too.\n"
+    "--bandwidth <n> Send at most <n> bytes/second to the terminal (slow links).\n"
+    "--buffer <size> Memory kept for piped input, e.g. 64M. Default: 16M.\n"
+    "--spill <size>  Disk used once --buffer fills, 0 for none. Default: 16M.\n"
+    "--pack <size>   Keep what --buffer can't hold compressed in memory, up to\n"
+    "                <size> compressed, instead of spilling it to disk.\n"
+    "--benchmark     Time the per-line work for these options and exit.\n"
+    "--export        Write the text as it would scroll to stdout and exit.\n"
+    "--nowrap        Don't word wrap; keep lines whole and pan across them with\n"
+    "                the left and right arrow keys ('home' goes back).\n"
+    "--colorize      Colour log levels (ERROR, WARN, INFO, DEBUG), timestamps\n"
+    "                and hex ids.\n"
+    "--resume        Carry on from where you quit this file last time.\n"
+    "--readahead <size>\n"
+    "                Read the file <size> (e.g. 8M) ahead of the scroll in the\n"
+    "                background, so a slow disk shows as \"buffering\".\n"
+    "--control <socket>\n"
+    "                Take commands (speed, pause, jump, pattern, load, status\n"
+    "                and the keys' names) on a Unix socket made at <socket>.\n"
+    "--collapse[=<n>]\n"
+    "                Show a run of lines repeating the previous <n> (default 1)\n"
+    "                as one \"[previous line repeated N times]\" line.\n"
+    "--mask          Collapse lines that differ only in their digits.\n"
+    "--skim-lines <n>\n"
+    "                Skim: show about every <n>th line, seeking between them.\n"
+    "--skim-bytes <size>\n"
+    "                Skim: show a line every <size>, e.g. 64M.\n"
+    "--latency <script>\n"
+    "                Press the keys in <script> (lines of \"<ms> <key>\") on a\n"
+    "                clock that skips the waits, and report how long each took\n"
+    "                to reach the screen.\n"
+    "--latency-max <ms>\n"
+    "                Exit with 1 if the 99th percentile key took longer.\n"
+    "--replay[=<x>]  Scroll log lines with the gaps between their timestamps,\n"
+    "                <x> times as fast. 'f' and 's' still speed up and slow down.\n"
+    "--max-gap <n>   Longest pause --replay makes, in seconds, 0 for no limit.\n"
+    "                Default: 10.\n"
+    "--rsvp <wpm>    Flash the text a word at a time in the middle of the\n"
+    "                screen, <wpm> words a minute.\n"
+    "--words <n>     Words shown at once with --rsvp, up to 10. Default: 1.\n"
+    "--rotated <log> Scroll <log>.N.gz ... <log>.1 <log> as one, oldest first.\n"
+    "                <log> can also be a quoted glob like 'app.log*'.\n"
+    "--pane <file>[:<n>[:<string>]]\n"
+    "                Scroll <file> beside the -f file and the other --panes,\n"
+    "                at <n> milliseconds and highlighting <string>.\n"
 
     "\tWhile textscroll is running you can use the option keys:\n"
     "'q' to quit.\n'p' to pause.\n'spacebar' to scroll super"
@@ -1088,24 +6887,158 @@ void usage(char *progname)
     "scrolling speed down in 25 percent increments.\n"
     "'o' to go back to original speed.\n'a' to toggle Auto-Pausing on/off.\n"
     "'e' open file in your editor. Uses $VISUAL, $EDITOR or /bin/vi.\n"
-    "'i' to view detailed file/program/etc information.\n");
+    "'i' to view detailed file/program/etc information.\n"
+    "'>' and '<' to jump to the next and previous line matching -w.\n"
+    "'left' and 'right' to pan half a screen with --nowrap.\n");
 
     exit(EXIT_SUCCESS);
 }
 
 void quit_cleanly(void)
 {
+    resume_save();
     unlink(tfile.text_file);
+    pane_cleanup();
+
+    if (tctl.path) {
+        unlink(tctl.path);
+    }
 
     if (tfile.piped) {
         unlink(tfile.text_pipe);
     }
 
+    mirror_end();
     clear();
     refresh();
     flushinp();
     endwin();
-    exit(EXIT_SUCCESS);
+    exit(latency_report());
+}
+
+/* Name the checkpoint after the file's full path */
+void resume_setup(void)
+{
+    char real[PATH_MAX], *c;
+    unsigned long long h = 14695981039346656037ULL;
+
+    if (!realpath(tfile.filename, real) || stat(real, &tresume.sb) < 0 ||
+        !S_ISREG(tresume.sb.st_mode)) {
+        return;
+    }
+
+    for (c = real; *c; c++) {
+        h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+
+    snprintf(tresume.path, sizeof tresume.path, "%sresume-%016llx", 
+        tfile.homedir, h);
+    snprintf(tresume.text, sizeof tresume.text, "%sresume_text", 
+        tfile.homedir);
+}
+
+/* the options that change what the text looks like, and so where its
+   lines start */
+unsigned int resume_how(void)
+{
+    return (thscroll.active ? 1 : 0) | (topt.view_normal ? 2 : 0);
+}
+
+/* Take up the checkpoint if it's for the file as it is now, processed
+   the same way. Returns TRUE if the text it was scrolled from has been
+   put back as text_file as well. */
+int resume_load(void)
+{
+    FILE *fp;
+    struct stat sb;
+    unsigned long dev, ino, text_ino;
+    long long size, text_size, offset;
+    long mtime, mtime_ns, text_mtime;
+    unsigned int how;
+    int got;
+
+    if (!tresume.path[0] || !(fp = fopen(tresume.path, "r"))) {
+        return FALSE;
+    }
+
+    got = fscanf(fp, "file %lu %lu %lld %ld %ld %u text %lu %lld %ld "
+                 "at %lld %lu %lu %u", &dev, &ino, &size, &mtime, &mtime_ns, 
+                 &how, &text_ino, &text_size, &text_mtime, &offset, 
+                 &tresume.line, &tresume.total, &tresume.speed);
+    fclose(fp);
+
+    if (got != 13 || dev != tresume.sb.st_dev || ino != tresume.sb.st_ino ||
+        size != tresume.sb.st_size || mtime != tresume.sb.st_mtim.tv_sec ||
+        mtime_ns != tresume.sb.st_mtim.tv_nsec || how != resume_how()) {
+        tresume.line = 0; /* the file's changed, start again */
+        return FALSE;
+    }
+
+    tresume.offset = offset;
+
+    /* the kept text is only ever the last file's */
+    if (stat(tresume.text, &sb) < 0 || sb.st_ino != text_ino || 
+        sb.st_size != text_size || sb.st_mtim.tv_sec != text_mtime) {
+        return FALSE;
+    }
+
+    unlink(tfile.text_file);
+
+    return link(tresume.text, tfile.text_file) == 0;
+}
+
+/* Keep the text as it was scrolled and note where we got to, for
+   --resume next time */
+void resume_save(void)
+{
+    struct scroll_state *st = tresume.st;
+    struct stat sb;
+    FILE *fp;
+
+    if (!st || tfile.growing) { /* half a text is no use */
+        return;
+    }
+
+    if (rename(tfile.text_file, tresume.text) || 
+        stat(tresume.text, &sb) < 0) {
+        return;
+    }
+
+    if (!(fp = fopen(tresume.path, "w"))) {
+        return;
+    }
+
+    fprintf(fp, "file %lu %lu %lld %ld %ld %u\ntext %lu %lld %ld\n"
+        "at %lld %lu %lu %u\n", (unsigned long)tresume.sb.st_dev, 
+        (unsigned long)tresume.sb.st_ino, (long long)tresume.sb.st_size, 
+        (long)tresume.sb.st_mtim.tv_sec, (long)tresume.sb.st_mtim.tv_nsec,
+        resume_how(), (unsigned long)sb.st_ino, (long long)sb.st_size,
+        (long)sb.st_mtim.tv_sec, (long long)twin.pos, st->line, 
+        tcount.done ? tcount.lines : 0, 
+        st->scroll_speed == 1 ? st->origspeed : st->scroll_speed);
+    fclose(fp);
+}
+
+/* Drop the checkpoint, and the kept text too if it was this file's */
+void resume_forget(void)
+{
+    FILE *fp;
+    struct stat sb;
+    unsigned long text_ino = 0;
+
+    if ((fp = fopen(tresume.path, "r"))) {
+        if (fscanf(fp, "file %*u %*u %*d %*d %*d %*u text %lu", 
+                   &text_ino) != 1) {
+            text_ino = 0;
+        }
+
+        fclose(fp);
+        unlink(tresume.path);
+    }
+
+    if (text_ino && stat(tresume.text, &sb) == 0 && sb.st_ino == text_ino) {
+        unlink(tresume.text);
+    }
 }
 
 /* checks if any non-digits are found in the input string */
@@ -1120,19 +7053,211 @@ int char_check(char *str)
     return 1;
 }
 
-long get_total_lines(FILE *fp)
+/* How many BUFMAX-sized reads a line of len bytes takes, since that's
+   what the scroll loops count as a line. */
+unsigned long int count_pieces(off_t len)
+{
+    return (len + BUFMAX - 2) / (BUFMAX - 1);
+}
+
+/* add up all the lines of the file, without holding up the scrolling */
+void *count_lines(void *arg)
+{
+    struct window_reader wr;
+    unsigned long int lines = 0;
+    off_t run = 0;
+    char *p, *end, *nl;
+
+    if (wr_open(&wr, tfile.text_file) < 0) {
+        tcount.done = TRUE;
+        return NULL;
+    }
+
+    while ((wr.pos < wr.size || wr_wait(&wr)) && wr_map(&wr, wr.pos) == 0) {
+        p = wr.map + (wr.pos - wr.base);
+        end = wr.map + wr.len;
+
+        while ((nl = memchr(p, '\n', end - p))) {
+            lines += count_pieces(run + (nl - p) + 1);
+            run = 0;
+            p = nl + 1;
+        }
+
+        run += end - p;
+        wr.pos = wr.base + wr.len;
+
+        if (lines > tcount.lines) { /* --resume may know the total already */
+            tcount.lines = lines;
+        }
+    }
+
+    if (run) {
+        lines += count_pieces(run);
+    }
+
+    wr_close(&wr);
+    tcount.lines = lines;
+    tcount.done = TRUE;
+
+    return NULL;
+}
+
+void start_line_count(void)
+{
+    if (pthread_create(&tcount.counter, NULL, count_lines, NULL) != 0) {
+        cperror("pthread_create()");
+    }
+
+    pthread_detach(tcount.counter);
+}
+
+/* --readahead: keep the page cache filled from the scroll's position to
+   tahead.size past it. A jump elsewhere starts over from there. */
+void *readahead_reader(void *arg)
+{
+    struct stat sb;
+    struct timespec until;
+    char *buf;
+    off_t at, len;
+    ssize_t got;
+    int fd;
+
+    if ((fd = open(tfile.text_file, O_RDONLY)) < 0 || 
+        !(buf = malloc(READAHEAD_CHUNK))) {
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        pthread_mutex_lock(&tahead.lock);
+        tahead.failed = TRUE;
+        pthread_mutex_unlock(&tahead.lock);
+        return NULL;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (;;) {
+        if (fstat(fd, &sb) < 0) {
+            sb.st_size = tahead.end;
+        }
+
+        pthread_mutex_lock(&tahead.lock);
+        tahead.end = sb.st_size; /* a decoder may still be writing it */
+
+        if (tahead.want < tahead.from || tahead.want > tahead.ready) {
+            tahead.from = tahead.ready = tahead.want;
+        }
+
+        at = tahead.ready;
+        len = tahead.want + tahead.size - at;
+
+        if (len > READAHEAD_CHUNK) {
+            len = READAHEAD_CHUNK;
+        }
+
+        if (len > sb.st_size - at) {
+            len = sb.st_size - at;
+        }
+
+        if (len <= 0) { /* far enough ahead, or at the end for now */
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += 100 * 1000000L;
+
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+
+            pthread_cond_timedwait(&tahead.moved, &tahead.lock, &until);
+            pthread_mutex_unlock(&tahead.lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&tahead.lock);
+
+        got = pread(fd, buf, len, at); /* the slow part, not under the lock */
+
+        pthread_mutex_lock(&tahead.lock);
+
+        if (got > 0 && tahead.ready == at) { /* not jumped away meanwhile */
+            tahead.ready += got;
+        }
+
+        pthread_mutex_unlock(&tahead.lock);
+
+        if (got <= 0) {
+            napms(50);
+        }
+    }
+
+    return NULL;
+}
+
+void start_readahead(void)
+{
+    tahead.want = tahead.from = tahead.ready = twin.pos;
+    tahead.end = twin.size;
+
+    if (pthread_create(&tahead.reader, NULL, readahead_reader, NULL) != 0) {
+        cperror("pthread_create()");
+    }
+
+    pthread_detach(tahead.reader);
+}
+
+/* --readahead: before a line is read, wait until the reader has it in,
+   keeping the keys and the status bar going */
+void readahead_wait(struct scroll_state *st)
+{
+    off_t need;
+    unsigned int ready;
+
+    for (;;) {
+        pthread_mutex_lock(&tahead.lock);
+        tahead.want = twin.pos;
+        need = twin.pos + BUFMAX < tahead.end ? twin.pos + BUFMAX : tahead.end;
+        ready = tahead.failed || 
+                (twin.pos >= tahead.from && need <= tahead.ready);
+        pthread_cond_signal(&tahead.moved);
+        pthread_mutex_unlock(&tahead.lock);
+
+        if (ready) {
+            break;
+        }
+
+        if (!tahead.stalled) {
+            tahead.stalled = TRUE;
+            tahead.stalls++;
+        }
+
+        st->status(st);
+        user_input(st);
+        napms(20);
+    }
+
+    tahead.stalled = FALSE;
+}
+
+/* how full, in percent, the read ahead is */
+int readahead_fill(void)
 {
-    char buf[255];
-    long linenum = 0;
+    off_t ahead;
+    int fill;
+
+    pthread_mutex_lock(&tahead.lock);
+    ahead = tahead.ready - tahead.want;
 
-    /* add up all the lines of the file */
-    while (fgets(buf, sizeof(buf), fp)) {
-        ++linenum;
+    if (tahead.ready >= tahead.end || tahead.failed) {
+        fill = 100; /* all there is has been read */
+    } else if (ahead <= 0 || tahead.want < tahead.from) {
+        fill = 0;
+    } else {
+        fill = ahead >= tahead.size ? 100 : ahead * 100 / tahead.size;
     }
 
-    rewind(fp);
+    pthread_mutex_unlock(&tahead.lock);
 
-    return (linenum);
+    return fill;
 }
 
 char *str_trunc(char *s, int n)
@@ -1164,14 +7289,20 @@ void my_perror(char *msg)
 
 void cperror(char *msg)
 {
+    int err = errno;
+
     endwin(); /* kill the window first so we can print to stdout */
+    output_written(); /* and get it to the terminal before the message */
+    errno = err;
     perror(msg);
+    tresume.st = NULL; /* don't save a run that went wrong */
     quit_cleanly();
 }
 
 /* terminal resizing functionality */
 void catch_sigwinch(int signo)
 {
+    output_resize();
     refresh();
     endwin();
     free(pscroll->scrollwin);